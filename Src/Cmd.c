@@ -4,7 +4,9 @@
 
 #include <string.h>
 #include <stdarg.h>
+#ifdef CMD_USE_VSNPRINTF
 #include <stdio.h>
+#endif
 
 
 /*
@@ -15,6 +17,67 @@
 
 #define LF				CMD_LINE_END
 
+#define IS_MENU(_node)	((_node)->type != Cmd_Node_Function)
+
+#ifndef CMD_USE_VSNPRINTF
+// Formatted output is written out in chunks of this size
+#define FORMAT_BFR_SIZE		32
+#endif
+
+#ifdef CMD_USE_HELP_TEXT
+// Descriptions are expanded in chunks of this size
+#define HELP_BFR_SIZE		32
+#define HELP_CODE			0x80
+#endif
+
+#ifdef CMD_USE_RECORDS
+// CBOR initial bytes. The major type is in the top 3 bits.
+#define CBOR_UINT		0x00
+#define CBOR_BYTES		0x40
+#define CBOR_TEXT		0x60
+#define CBOR_MAP		0xA0
+#define CBOR_MAP_OPEN	0xBF
+#define CBOR_BREAK		0xFF
+#endif
+
+#ifdef CMD_USE_STREAM
+#if (CMD_STREAM_WINDOW & (CMD_STREAM_WINDOW - 1)) || (CMD_STREAM_WINDOW > 256)
+#error "CMD_STREAM_WINDOW must be a power of two, of at most 256"
+#endif
+#define STREAM_MASK			(CMD_STREAM_WINDOW - 1)
+#define STREAM_MIN_MATCH	3
+#define STREAM_MAX_MATCH	(STREAM_MIN_MATCH + 254)
+#define STREAM_END			0xFF	// The length byte of the match that ends the stream
+#endif
+
+#ifdef CMD_USE_DUMP
+// The number of bytes on each row, for each format.
+#define DUMP_ROW_SIZE		16
+#define DUMP_HEX_SIZE		32
+#define DUMP_BASE64_SIZE	48
+// Large enough for the longest row, which is the hex and ASCII row.
+#define DUMP_BFR_SIZE		(8 + 2 + (DUMP_ROW_SIZE * 3) + 1 + DUMP_ROW_SIZE + 2 + sizeof(LF))
+#endif
+
+#ifdef CMD_USE_SESSION_LOG
+#define SESSION_VERSION		2
+// A record type, and two varints of up to 5 bytes.
+#define SESSION_HEAD_SIZE	11
+#endif
+
+#if defined(CMD_USE_REPEAT) && !defined(CMD_USE_STRING_ARGS)
+#error "CMD_USE_REPEAT requires CMD_USE_STRING_ARGS"
+#endif
+
+#ifdef CMD_USE_TRACE
+#if (CMD_TRACE_SIZE & (CMD_TRACE_SIZE - 1))
+#error "CMD_TRACE_SIZE must be a power of two"
+#endif
+#define CMD_TRACE(_type, _arg)	Cmd_Trace(_type, (uint32_t)(uintptr_t)(_arg))
+#else
+#define CMD_TRACE(_type, _arg)
+#endif
+
 /*
  * PRIVATE TYPES
  */
@@ -31,6 +94,21 @@ typedef enum {
 	Cmd_Token_Broken,
 } Cmd_TokenStatus_t;
 
+#ifndef CMD_USE_VSNPRINTF
+typedef struct {
+	Cmd_Line_t * line;
+	uint32_t count;
+	char bfr[FORMAT_BFR_SIZE];
+} Cmd_Formatter_t;
+
+typedef enum {
+	Cmd_Format_Left = (1 << 0),
+	Cmd_Format_Zero = (1 << 1),
+	Cmd_Format_Space = (1 << 2),
+	Cmd_Format_Long = (1 << 3),
+} Cmd_FormatFlag_t;
+#endif
+
 #ifdef CMD_USE_ANSI
 typedef enum {
 	Cmd_Ansi_None,
@@ -39,35 +117,130 @@ typedef enum {
 } Cmd_AnsiState_t;
 #endif
 
+#ifdef CMD_USE_REPEAT
+// Placed above the heap reserved for a binding, so that reservations can be returned in any order.
+typedef struct {
+	uint32_t size;		// The bytes reserved below the header
+	bool held;
+} Cmd_Kept_t;
+#endif
+
+#ifdef CMD_USE_NOTIFY
+typedef enum {
+	Cmd_Notify_Shown,
+	Cmd_Notify_Hidden,	// The line was erased by a notification, and is redrawn once by the next flush.
+	Cmd_Notify_Busy,	// The line is being parsed, so output is already in order.
+} Cmd_NotifyState_t;
+#endif
+
 /*
  * PRIVATE PROTOTYPES
  */
 
+static void Cmd_Write(Cmd_Line_t * line, const uint8_t * data, uint32_t size);
+static void Cmd_BeginReply(Cmd_Line_t * line, Cmd_ReplyLevel_t level);
+static void Cmd_EndReply(Cmd_Line_t * line, Cmd_ReplyLevel_t level);
+static void Cmd_VPrintf(Cmd_Line_t * line, Cmd_ReplyLevel_t level, const char * fmt, va_list ap);
+#ifdef CMD_USE_RECORDS
+static void Cmd_WriteStr(Cmd_Line_t * line, const char * str);
+static void Cmd_WriteDecimal(Cmd_Line_t * line, uint32_t value);
+static void Cmd_WriteHex(Cmd_Line_t * line, const uint8_t * data, uint32_t size);
+static void Cmd_WriteJsonString(Cmd_Line_t * line, const char * str);
+static void Cmd_WriteCborHead(Cmd_Line_t * line, uint8_t major, uint32_t value);
+static void Cmd_RecordKey(Cmd_Line_t * line, const char * key);
+#endif
+#ifdef CMD_USE_STREAM
+static void Cmd_StreamMatch(Cmd_Line_t * line, Cmd_Stream_t * stream);
+static bool Cmd_StreamExtend(Cmd_Stream_t * stream);
+static void Cmd_StreamItem(Cmd_Line_t * line, Cmd_Stream_t * stream, bool match, uint8_t a, uint8_t b);
+#endif
+#ifdef CMD_USE_DUMP
+static char * Cmd_DumpRow(char * dst, const uint8_t * data, uint32_t count, uint32_t address);
+static char * Cmd_DumpHex(char * dst, const uint8_t * data, uint32_t count);
+static char * Cmd_DumpBase64(char * dst, const uint8_t * data, uint32_t count);
+#endif
+
+#ifndef CMD_USE_VSNPRINTF
+static void Cmd_Format(Cmd_Line_t * line, const char * fmt, va_list ap);
+static void Cmd_FormatChar(Cmd_Formatter_t * fmt, char ch);
+static void Cmd_FormatField(Cmd_Formatter_t * fmt, const char * str, uint32_t size, uint32_t width, uint8_t flags);
+static void Cmd_FormatNumber(Cmd_Formatter_t * fmt, uint32_t value, uint32_t base, char sign, const char * digits, uint32_t width, uint8_t flags);
+static void Cmd_FormatHex(Cmd_Formatter_t * fmt, const uint8_t * data, uint32_t count, uint8_t flags);
+#endif
 static void Cmd_FreeAll(Cmd_Line_t * line);
 static uint32_t Cmd_MemRemaining(Cmd_Line_t * line);
+static Cmd_ArgValue_t * Cmd_MallocArgs(Cmd_Line_t * line, uint32_t count, uint32_t reserve);
 
 static Cmd_TokenStatus_t Cmd_ParseToken(const char ** str, Cmd_Token_t * token);
 static Cmd_TokenStatus_t Cmd_NextToken(Cmd_Line_t * line, const char ** str, Cmd_Token_t * token);
 static bool Cmd_ParseArg(Cmd_Line_t * line, const Cmd_Arg_t * arg, Cmd_ArgValue_t * value, Cmd_Token_t * token);
+#ifdef CMD_USE_LIST_ARGS
+static uint32_t Cmd_ListWidth(uint8_t type);
+#endif
+#ifdef CMD_USE_REGISTERS
+static Cmd_Register_t * Cmd_FindRegister(Cmd_Line_t * line, const char * name);
+#endif
 static const char * Cmd_ArgTypeStr(Cmd_Line_t * line, const Cmd_Arg_t * arg);
+static int32_t Cmd_CompareName(const char * name, const char * str, uint32_t size);
+static int32_t Cmd_FindName(const void * const * items, bool nodes, uint32_t count, const uint8_t * index, const char * str, uint32_t size);
+static const Cmd_Node_t * Cmd_FindNode(Cmd_Line_t * line, const Cmd_Node_t * node, const char * str, uint32_t size, uint32_t * selection);
+#if defined(CMD_HELP_TOKEN) || defined(CMD_USE_TABCOMPLETE)
+static const char * Cmd_ChildName(Cmd_Line_t * line, const Cmd_Node_t * node, uint32_t n, char * bfr);
+#endif
+static const Cmd_Node_t * Cmd_FindFunction(Cmd_Line_t * line, const char * str, const char ** args, uint32_t * selection);
+#ifdef CMD_USE_MENU_POOLS
+static uint32_t Cmd_PoolPosition(const Cmd_MenuPool_t * pool, const char * name);
+#endif
+
+static void Cmd_ResetParse(Cmd_Line_t * line);
+static void Cmd_TrackParse(Cmd_Line_t * line, uint32_t from);
+static void Cmd_ResolveToken(Cmd_Line_t * line, uint32_t end);
 
 static void Cmd_Run(Cmd_Line_t * line, const Cmd_Node_t * node, const char * str);
-static void Cmd_RunRoot(Cmd_Line_t * line, const char * str);
-static void Cmd_RunMenu(Cmd_Line_t * line, const Cmd_Node_t * node, const char * str);
+static void Cmd_RunRoot(Cmd_Line_t * line);
+static const Cmd_Node_t * Cmd_RunMenu(Cmd_Line_t * line, const Cmd_Node_t * node, const char ** str);
 static void Cmd_RunFunction(Cmd_Line_t * line, const Cmd_Node_t * node, const char * str);
+static bool Cmd_ParseArgs(Cmd_Line_t * line, const Cmd_Node_t * node, const char * str, Cmd_ArgValue_t * args);
+#ifdef CMD_USE_VARIADIC_ARGS
+static bool Cmd_ParseVariadic(Cmd_Line_t * line, const Cmd_Arg_t * arg, uint32_t argn, Cmd_ArgValue_t * value, const char * str, Cmd_Token_t * token);
+#endif
 
 #ifdef CMD_HELP_TOKEN
 static void Cmd_PrintMenuHelp(Cmd_Line_t * line, const Cmd_Node_t * node);
 static void Cmd_PrintFunctionHelp(Cmd_Line_t * line, const Cmd_Node_t * node);
 #endif
+#ifdef CMD_USE_HELP_TEXT
+static void Cmd_PrintHelpText(Cmd_Line_t * line, const char * prefix, const uint8_t * help);
+#endif
+#if defined(CMD_HELP_TOKEN) && defined(CMD_USE_CHOICE_ARGS)
+static void Cmd_PrintChoices(Cmd_Line_t * line, const Cmd_Choices_t * choices);
+#endif
 
 #ifdef CMD_USE_BELL
 static void Cmd_Bell(Cmd_Line_t * line);
 #endif
 
 #ifdef CMD_USE_TABCOMPLETE
-static const char * Cmd_TabComplete(Cmd_Line_t * line, const char * str);
+static void Cmd_TabComplete(Cmd_Line_t * line);
 static const char * Cmd_TabCompleteMenu(Cmd_Line_t * line, const Cmd_Node_t * node, const char * str);
+#ifdef CMD_USE_CHOICE_ARGS
+static const char * Cmd_TabCompleteArgs(Cmd_Line_t * line, const Cmd_Node_t * node, const char * str);
+#endif
+#endif
+
+#ifdef CMD_USE_REPEAT
+static void Cmd_RepeatFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args);
+static void Cmd_EveryFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args);
+static void Cmd_StopEvery(Cmd_Line_t * line);
+static bool Cmd_KeepBinding(Cmd_Line_t * line, Cmd_Binding_t * binding);
+static bool Cmd_KeepValue(Cmd_Line_t * line, const Cmd_Arg_t * arg, Cmd_ArgValue_t * value);
+static bool Cmd_KeepData(Cmd_Line_t * line, uint8_t ** data, uint32_t size, uint32_t align);
+static uint32_t Cmd_KeptHeader(Cmd_Heap_t * mem, uint32_t top);
+static void Cmd_ReleaseKept(Cmd_Heap_t * mem, Cmd_Kept_t * kept);
+#endif
+
+#ifdef CMD_USE_NOTIFY
+static void Cmd_HideLine(Cmd_Line_t * line);
 #endif
 
 #ifdef CMD_USE_ANSI
@@ -76,52 +249,174 @@ static void Cmd_ClearLine(Cmd_Line_t * line);
 static void Cmd_RecallLine(Cmd_Line_t * line);
 #endif
 
+#ifdef CMD_USE_TRACE
+static void Cmd_Trace(uint8_t type, uint32_t arg);
+static void Cmd_TraceShowFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args);
+static void Cmd_TraceDumpFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args);
+static void Cmd_TraceClearFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args);
+#endif
+
+#ifdef CMD_USE_SESSION_LOG
+static void Cmd_SessionRecord(Cmd_Line_t * line, uint8_t type, const uint8_t * data, uint32_t size);
+static uint8_t * Cmd_SessionVarint(uint8_t * dst, uint32_t value);
+#endif
+
 /*
  * PRIVATE VARIABLES
  */
 
+#ifdef CMD_USE_REPEAT
+static const Cmd_Arg_t gRepeatArgs[] = {
+	CMD_ARGUMENT(Cmd_Arg_Number, "count"),
+	CMD_ARGUMENT(Cmd_Arg_String, "command"),
+};
+
+static const Cmd_Arg_t gEveryArgs[] = {
+	CMD_ARGUMENT(Cmd_Arg_Number, "period"),
+	CMD_ARGUMENT(Cmd_Arg_String | Cmd_Arg_Optional, "command"),
+};
+#endif //CMD_USE_REPEAT
+
+#ifdef CMD_USE_TRACE
+static struct {
+	Cmd_TraceEvent_t events[CMD_TRACE_SIZE];
+	uint32_t index; // Total events recorded. This is allowed to wrap.
+} gTrace;
+
+static const char * const gTraceNames[] = {
+	"line",
+	"node",
+	"argerror",
+	"enter",
+	"exit",
+	"overrun",
+	"flush",
+	"discard",
+};
+
+static const Cmd_Node_t gTraceShowNode = CMD_FUNCTION("show", Cmd_TraceShowFunction);
+static const Cmd_Node_t gTraceDumpNode = CMD_FUNCTION("dump", Cmd_TraceDumpFunction);
+static const Cmd_Node_t gTraceClearNode = CMD_FUNCTION("clear", Cmd_TraceClearFunction);
+static const Cmd_Node_t * const gTraceItems[] = {
+	&gTraceShowNode,
+	&gTraceDumpNode,
+	&gTraceClearNode,
+};
+#endif //CMD_USE_TRACE
+
+/*
+ * PUBLIC VARIABLES
+ */
+
+#ifdef CMD_USE_REPEAT
+const Cmd_Node_t Cmd_RepeatNode = CMD_AFUNCTION("repeat", Cmd_RepeatFunction, gRepeatArgs);
+const Cmd_Node_t Cmd_EveryNode = CMD_AFUNCTION("every", Cmd_EveryFunction, gEveryArgs);
+#endif
+
+#ifdef CMD_USE_TRACE
+const Cmd_Node_t Cmd_TraceNode = CMD_MENU("trace", gTraceItems);
+#endif
+
 /*
  * PUBLIC FUNCTIONS
  */
 
 void Cmd_Init(Cmd_Line_t * line, const Cmd_Node_t * root, void (*print)(const uint8_t * data, uint32_t size), void * heap, uint32_t heapSize)
 {
-	line->bfr.data = heap;
+	// The line buffer is taken from the start of the heap, followed by an aligned heap descriptor.
+	uint8_t * bfr = heap;
+	uintptr_t start = ((uintptr_t)(bfr + CMD_MAX_LINE) + sizeof(void *) - 1) & ~(uintptr_t)(sizeof(void *) - 1);
+	Cmd_Heap_t * mem = (Cmd_Heap_t *)start;
+	uint8_t * data = (uint8_t *)(mem + 1);
+	Cmd_InitHeap(mem, data, heapSize - (data - bfr));
+	Cmd_InitShared(line, root, print, (char *)bfr, mem);
+}
+
+void Cmd_InitShared(Cmd_Line_t * line, const Cmd_Node_t * root, void (*print)(const uint8_t * data, uint32_t size), char * bfr, Cmd_Heap_t * heap)
+{
+	line->bfr.data = bfr;
 	line->bfr.size = CMD_MAX_LINE;
 	line->root = root;
 	line->print = print;
-
-	line->mem.heap = heap + CMD_MAX_LINE;
-	line->mem.size = heapSize - CMD_MAX_LINE;
-	line->mem.head = line->mem.heap;
+	line->capture = NULL;
+	line->mem = heap;
+	line->selection = 0;
 
 	memset(&line->cfg, 0, sizeof(line->cfg));
+#ifdef CMD_USE_SESSION_LOG
+	line->session.write = NULL;
+	line->session.busy = false;
+#endif
+#ifdef CMD_USE_REPEAT
+	line->every.binding.node = NULL;
+	line->every.kept = NULL;
+	line->every.stale = NULL;
+	line->every.running = false;
+	line->every.now = 0;
+#endif
 
 	// Note, do not set properties that will be set by Cmd_Start.
 	Cmd_Start(line);
 }
 
+void Cmd_InitHeap(Cmd_Heap_t * heap, void * data, uint32_t size)
+{
+	heap->heap = data;
+	heap->size = size;
+	heap->head = data;
+#ifdef CMD_USE_REPEAT
+	heap->end = size;
+#endif
+}
+
 void Cmd_Start(Cmd_Line_t * line)
 {
 	line->bfr.index = 0;
 	line->bfr.recall_index = 0;
 	line->last_ch = 0;
+	Cmd_ResetParse(line);
 #ifdef CMD_USE_ANSI
 	line->ansi = Cmd_Ansi_None;
 #endif
+#ifdef CMD_USE_REPEAT
+	Cmd_StopEvery(line);
+#endif
+#ifdef CMD_USE_NOTIFY
+	line->notify = Cmd_Notify_Shown;
+#endif
+#ifdef CMD_USE_REGISTERS
+	for (uint32_t i = 0; i < CMD_REGISTER_COUNT; i++)
+	{
+		line->registers[i].name[0] = 0;
+	}
+#endif
 #ifdef CMD_PROMPT
 	if (line->cfg.prompt)
 	{
-		line->print((uint8_t *)CMD_PROMPT, strlen(CMD_PROMPT));
+		Cmd_Write(line, (uint8_t *)CMD_PROMPT, strlen(CMD_PROMPT));
 	}
 #endif //CMD_PROMPT
 }
 
 void Cmd_Parse(Cmd_Line_t * line, const uint8_t * data, uint32_t count)
 {
+#ifdef CMD_USE_SESSION_LOG
+	if (line->session.write != NULL)
+	{
+		Cmd_SessionRecord(line, Cmd_Session_Input, data, count);
+	}
+#endif
 #ifdef CMD_USE_ECHO
 	const uint8_t * echo_data = data;
 #endif //CMD_USE_ECHO
+#ifdef CMD_USE_NOTIFY
+	Cmd_Redraw(line);
+	line->notify = Cmd_Notify_Busy;
+#endif
+#ifdef CMD_USE_SESSION_LOG
+	bool busy = line->session.busy;
+	line->session.busy = true;
+#endif
 
 	while(count--)
 	{
@@ -154,64 +449,52 @@ void Cmd_Parse(Cmd_Line_t * line, const uint8_t * data, uint32_t count)
 				if (line->cfg.echo)
 				{
 					// Print everything up until now excluding the current char
-					line->print(echo_data, (data - echo_data) - 1);
+					Cmd_Write(line, echo_data, (data - echo_data) - 1);
 					echo_data = data;
 					// Now print a full eol.
-					line->print((uint8_t *)LF, 2);
+					Cmd_Write(line, (uint8_t *)LF, 2);
 				}
 #endif //CMD_USE_ECHO
 				if (line->bfr.index)
 				{
 					// null terminate command and run it.
 					line->bfr.data[line->bfr.index] = 0;
-					Cmd_RunRoot(line, line->bfr.data);
+					CMD_TRACE(Cmd_Trace_Line, line->bfr.index);
+					Cmd_RunRoot(line);
 					line->bfr.index = 0;
+					Cmd_ResetParse(line);
 				}
 #ifdef CMD_PROMPT
 				if (line->cfg.prompt)
 				{
-					line->print((uint8_t *)CMD_PROMPT, strlen(CMD_PROMPT));
+					Cmd_Write(line, (uint8_t *)CMD_PROMPT, strlen(CMD_PROMPT));
 				}
 #endif //CMD_PROMPT
 				break;
 #ifdef CMD_USE_TABCOMPLETE
 			case '\t':
-				line->bfr.data[line->bfr.index] = 0;
-				const char * append = Cmd_TabComplete(line, line->bfr.data);
-				if (append != NULL)
-				{
-					uint32_t append_count = strlen(append);
-					uint32_t newindex = line->bfr.index + append_count;
-					if (newindex < line->bfr.size)
-					{
-						// A tab complete should not overflow the line buffer.
-						memcpy(line->bfr.data + line->bfr.index, append, append_count);
-						line->bfr.index += append_count;
-						line->bfr.recall_index = line->bfr.index;
-						line->print((uint8_t *)append, append_count);
-					}
-				}
-#ifdef CMD_USE_BELL
-				else
-				{
-					Cmd_Bell(line);
-				}
-#endif //CMD_USE_BELL
 #ifdef CMD_USE_ECHO
 				if (line->cfg.echo)
 				{
 					// Print everything up until now excluding the current char
-					// This is needed to swallow the \t char.
-					line->print(echo_data, (data - echo_data) - 1);
+					// This is needed to swallow the \t char, and must precede the completion.
+					Cmd_Write(line, echo_data, (data - echo_data) - 1);
 					echo_data = data;
 				}
 #endif //CMD_USE_ECHO
+				Cmd_TabComplete(line);
 				break;
 #endif //CMD_USE_TABCOMPLETE
 			case DEL:
 				if (line->bfr.index)
 				{
 					line->bfr.index--;
+					if (line->bfr.index <= line->parse.start || line->bfr.index <= line->parse.halt)
+					{
+						// We have removed a token end that the parse state depends on.
+						Cmd_ResetParse(line);
+						Cmd_TrackParse(line, 0);
+					}
 				}
 #ifdef CMD_USE_BELL
 				else
@@ -226,7 +509,7 @@ void Cmd_Parse(Cmd_Line_t * line, const uint8_t * data, uint32_t count)
 				if (line->cfg.echo)
 				{
 					// Swallow this char.
-					line->print(echo_data, (data - echo_data) - 1);
+					Cmd_Write(line, echo_data, (data - echo_data) - 1);
 					echo_data = data;
 				}
 #endif //CMD_USE_ECHO
@@ -238,11 +521,13 @@ void Cmd_Parse(Cmd_Line_t * line, const uint8_t * data, uint32_t count)
 				{
 					// Need to leave room for at least a null char.
 					line->bfr.data[line->bfr.index++] = ch;
+					Cmd_TrackParse(line, line->bfr.index - 1);
 				}
 				else
 				{
 					// Discard the line
 					line->bfr.index = 0;
+					Cmd_ResetParse(line);
 				}
 				line->bfr.recall_index = line->bfr.index;
 				break;
@@ -253,160 +538,1207 @@ void Cmd_Parse(Cmd_Line_t * line, const uint8_t * data, uint32_t count)
 #ifdef CMD_USE_ECHO
 	if (line->cfg.echo && echo_data < data)
 	{
-		line->print(echo_data, data - echo_data);
+		Cmd_Write(line, echo_data, data - echo_data);
 	}
 #endif //CMD_USE_ECHO
+#ifdef CMD_USE_NOTIFY
+	line->notify = Cmd_Notify_Shown;
+#endif
+#ifdef CMD_USE_SESSION_LOG
+	line->session.busy = busy;
+#endif
 }
 
-void Cmd_Print(Cmd_Line_t * line, Cmd_ReplyLevel_t level, const char * data, uint32_t count)
+bool Cmd_Bind(Cmd_Line_t * line, Cmd_Binding_t * binding, const char * str)
 {
-#ifdef CMD_USE_COLOR
-	if (line->cfg.color)
+	binding->selection = 0;
+	const Cmd_Node_t * node = Cmd_FindFunction(line, str, &str, &binding->selection);
+	if (node == NULL || node->func.arglen > CMD_MAX_ARGS || !Cmd_ParseArgs(line, node, str, binding->args))
 	{
-		switch (level)
-		{
-		case Cmd_Reply_Warn:
-			line->print((uint8_t *)"\x00\x1b[33m", 6);
-			break;
-		case Cmd_Reply_Error:
-			line->print((uint8_t *)"\x00\x1b[31m", 6);
-			break;
-		case Cmd_Reply_Info:
-			break;
-		}
+		return false;
 	}
-#endif //CMD_USE_COLOR
-	line->print((uint8_t *)data, count);
-#ifdef CMD_USE_COLOR
-	if (line->cfg.color)
+	binding->node = node;
+	return true;
+}
+
+void Cmd_Invoke(Cmd_Line_t * line, Cmd_Binding_t * binding)
+{
+	// Anything the command leaves on the heap is discarded, so that repeated invocations do not accumulate.
+	// The binding may be stopped by its own command, so the node is held for the duration.
+	const Cmd_Node_t * node = binding->node;
+	if (node == NULL)
 	{
-		switch (level)
+		return;
+	}
+	void * head = line->mem->head;
+	uint32_t outer = line->selection;
+	line->selection = binding->selection;
+	CMD_TRACE(Cmd_Trace_Enter, node);
+	node->func.callback(line, binding->args);
+	CMD_TRACE(Cmd_Trace_Exit, node);
+	line->selection = outer;
+	Cmd_Free(line, head);
+}
+
+bool Cmd_Exec(Cmd_Line_t * line, const Cmd_Node_t * node, const Cmd_ArgValue_t * args, uint32_t argc)
+{
+	if (node->type != Cmd_Node_Function)
+	{
+		Cmd_Printf(line, Cmd_Reply_Error, "<menu: %s> is not a function" LF, node->name);
+		return false;
+	}
+	if (argc > node->func.arglen)
+	{
+		Cmd_Printf(line, Cmd_Reply_Error, "<func: %s> takes maximum %d arguments" LF, node->name, node->func.arglen);
+		return false;
+	}
+
+	// Copy the args, as the callback is free to modify them.
+	void * head = line->mem->head;
+	Cmd_ArgValue_t * values = Cmd_MallocArgs(line, node->func.arglen, 0);
+	if (values == NULL)
+	{
+		return false;
+	}
+	for (uint32_t argn = 0; argn < node->func.arglen; argn++)
+	{
+		const Cmd_Arg_t * arg = &node->func.args[argn];
+		if (argn < argc && args[argn].present)
 		{
-		case Cmd_Reply_Warn:
-		case Cmd_Reply_Error:
-			line->print((uint8_t *)"\x00\x1b[0m", 5);
-			break;
-		case Cmd_Reply_Info:
-			break;
+			values[argn] = args[argn];
+		}
+		else if (arg->type & Cmd_Arg_Optional)
+		{
+			values[argn].present = false;
+		}
+		else
+		{
+			Cmd_Printf(line, Cmd_Reply_Error, "Argument %d is <%s: %s>" LF, argn+1, Cmd_ArgTypeStr(line, arg), arg->name);
+			Cmd_Free(line, head);
+			return false;
 		}
 	}
-#endif //CMD_USE_COLOR
-#ifdef CMD_USE_BELL
-	if (level == Cmd_Reply_Error)
+	CMD_TRACE(Cmd_Trace_Enter, node);
+	node->func.callback(line, values);
+	CMD_TRACE(Cmd_Trace_Exit, node);
+	Cmd_Free(line, head);
+	return true;
+}
+
+bool Cmd_ExecPath(Cmd_Line_t * line, const char * path, const Cmd_ArgValue_t * args, uint32_t argc)
+{
+	void * head = line->mem->head;
+	uint32_t selection = 0;
+	const Cmd_Node_t * node = Cmd_FindFunction(line, path, &path, &selection);
+	Cmd_Free(line, head);
+	if (node == NULL)
 	{
-		Cmd_Bell(line);
+		return false;
 	}
-#endif //CMD_USE_BELL
+	while (CMD_CHAR_CLASS(*path) & Cmd_Char_Space)
+	{
+		path++;
+	}
+	if (*path != 0)
+	{
+		Cmd_Printf(line, Cmd_Reply_Error, "'%s' is not a path to a function" LF, path);
+		return false;
+	}
+	// The selection of the calling command is restored once this one is done.
+	uint32_t outer = line->selection;
+	line->selection = selection;
+	bool success = Cmd_Exec(line, node, args, argc);
+	line->selection = outer;
+	return success;
 }
 
-void Cmd_Prints(Cmd_Line_t * line, Cmd_ReplyLevel_t level, const char * str)
+#ifdef CMD_USE_MENU_POOLS
+bool Cmd_Attach(Cmd_MenuPool_t * pool, const Cmd_Node_t * node)
 {
-	Cmd_Print(line, level, str, strlen(str));
+	uint32_t count = pool->node.menu.count;
+	uint32_t pos = Cmd_PoolPosition(pool, node->name);
+	if (count >= pool->size || (pos < count && strcmp(pool->slots[pool->index[pos]]->name, node->name) == 0))
+	{
+		return false;
+	}
+	// The node takes the next slot, and its position is inserted into the index.
+	pool->slots[count] = node;
+	memmove(pool->index + pos + 1, pool->index + pos, count - pos);
+	pool->index[pos] = count;
+	pool->node.menu.count = count + 1;
+	return true;
 }
 
-void Cmd_Printf(Cmd_Line_t * line, Cmd_ReplyLevel_t level, const char * fmt, ...)
+bool Cmd_Detach(Cmd_MenuPool_t * pool, const Cmd_Node_t * node)
 {
-    va_list ap;
-    va_start(ap, fmt);
-    // Take whatevers left - because we will immediately free it.
-    uint32_t free = Cmd_MemRemaining(line);
-    char * bfr = Cmd_Malloc(line, free);
-    uint32_t written = vsnprintf(bfr, free, fmt, ap);
-    va_end(ap);
-    Cmd_Print(line, level, bfr, written);
-    Cmd_Free(line, bfr);
+	uint32_t count = pool->node.menu.count;
+	uint32_t pos = Cmd_PoolPosition(pool, node->name);
+	if (pos >= count || pool->slots[pool->index[pos]] != node)
+	{
+		return false;
+	}
+	uint32_t slot = pool->index[pos];
+	memmove(pool->index + pos, pool->index + pos + 1, count - pos - 1);
+	pool->node.menu.count = --count;
+	if (slot != count)
+	{
+		// The last node is moved into the free slot, so that the slots stay packed.
+		const Cmd_Node_t * last = pool->slots[count];
+		pool->slots[slot] = last;
+		pool->index[Cmd_PoolPosition(pool, last->name)] = slot;
+	}
+	return true;
 }
+#endif //CMD_USE_MENU_POOLS
 
-void * Cmd_Malloc(Cmd_Line_t * line, uint32_t size)
+Cmd_Capture_t * Cmd_Capture(Cmd_Line_t * line, Cmd_Capture_t * capture)
 {
-	if (Cmd_MemRemaining(line) < size)
+	Cmd_Capture_t * previous = line->capture;
+	line->capture = capture;
+	return previous;
+}
+
+#ifdef CMD_USE_SESSION_LOG
+void Cmd_SessionLog(Cmd_Line_t * line, void (*write)(const uint8_t * data, uint32_t size))
+{
+	line->session.write = write;
+	if (write != NULL)
 	{
-		Cmd_Prints(line, Cmd_Reply_Error, "MEMORY OVERRUN" LF);
+		uint8_t flags = 0;
+#ifdef CMD_USE_COLOR
+		flags |= line->cfg.color ? Cmd_Session_Color : 0;
+#endif
+#ifdef CMD_USE_BELL
+		flags |= line->cfg.bell ? Cmd_Session_Bell : 0;
+#endif
+#ifdef CMD_USE_ECHO
+		flags |= line->cfg.echo ? Cmd_Session_Echo : 0;
+#endif
+#ifdef CMD_PROMPT
+		flags |= line->cfg.prompt ? Cmd_Session_Prompt : 0;
+#endif
+		uint32_t size = line->mem->size;
+		uint8_t header[] = {
+			'C', 'm', 'd', 'S', SESSION_VERSION, flags,
+			(uint8_t)size, (uint8_t)(size >> 8), (uint8_t)(size >> 16), (uint8_t)(size >> 24)
+		};
+		line->session.last = CMD_SESSION_TIME();
+		write(header, sizeof(header));
 	}
-	// Ignore overrun and do it anyway.....
-	void * ptr = line->mem.head;
-	line->mem.head += size;
-	return ptr;
 }
+#endif
 
-void Cmd_Free(Cmd_Line_t * line, void * ptr)
+#ifdef CMD_USE_REPEAT
+void Cmd_Tick(Cmd_Line_t * line, uint32_t now)
 {
-	if (ptr >= line->mem.heap)
+#ifdef CMD_USE_NOTIFY
+	// Messages since the last tick are flushed with a single redraw, in the same way as Cmd_Parse.
+	Cmd_Redraw(line);
+#endif
+#ifdef CMD_USE_SESSION_LOG
+	if (line->session.write != NULL)
+	{
+		Cmd_SessionRecord(line, Cmd_Session_Tick, NULL, now);
+	}
+	bool busy = line->session.busy;
+	line->session.busy = true;
+#endif
+	line->every.now = now;
+	if (line->every.binding.node != NULL && now - line->every.last >= line->every.period)
 	{
-		line->mem.head = ptr;
+		line->every.last = now;
+#ifdef CMD_USE_NOTIFY
+		// The command is run while the line is being typed, so its output is handled as a notification.
+		Cmd_HideLine(line);
+#endif
+		// The command may stop or replace its own binding. A copy is invoked, and the kept data is held until it returns.
+		Cmd_Binding_t binding = line->every.binding;
+		line->every.running = true;
+		Cmd_Invoke(line, &binding);
+		line->every.running = false;
+		if (line->every.stale != NULL)
+		{
+			Cmd_ReleaseKept(line->mem, line->every.stale);
+			line->every.stale = NULL;
+		}
+#ifdef CMD_USE_NOTIFY
+		Cmd_Redraw(line);
+#endif
 	}
+#ifdef CMD_USE_SESSION_LOG
+	line->session.busy = busy;
+#endif
 }
+#endif //CMD_USE_REPEAT
 
-/*
- * PRIVATE FUNCTIONS
- */
+void Cmd_Print(Cmd_Line_t * line, Cmd_ReplyLevel_t level, const char * data, uint32_t count)
+{
+	Cmd_BeginReply(line, level);
+	Cmd_Write(line, (uint8_t *)data, count);
+	Cmd_EndReply(line, level);
+}
 
-static void Cmd_FreeAll(Cmd_Line_t * line)
+void Cmd_Prints(Cmd_Line_t * line, Cmd_ReplyLevel_t level, const char * str)
 {
-	line->mem.head = line->mem.heap;
+	Cmd_Print(line, level, str, strlen(str));
 }
 
-uint32_t Cmd_MemRemaining(Cmd_Line_t * line)
+void Cmd_Printf(Cmd_Line_t * line, Cmd_ReplyLevel_t level, const char * fmt, ...)
 {
-	int32_t rem = line->mem.size - (line->mem.head - line->mem.heap);
-	if (rem < 0) { return 0; }
-	return rem;
+    va_list ap;
+    va_start(ap, fmt);
+    Cmd_VPrintf(line, level, fmt, ap);
+    va_end(ap);
 }
 
-static Cmd_TokenStatus_t Cmd_ParseToken(const char ** str, Cmd_Token_t * token)
+#ifdef CMD_USE_NOTIFY
+void Cmd_Notify(Cmd_Line_t * line, Cmd_ReplyLevel_t level, const char * str)
 {
-	const char * head = *str;
-	while (1)
+	Cmd_HideLine(line);
+	Cmd_Prints(line, level, str);
+}
+
+void Cmd_Log(Cmd_Line_t * line, Cmd_ReplyLevel_t level, const char * fmt, ...)
+{
+	Cmd_HideLine(line);
+    va_list ap;
+    va_start(ap, fmt);
+    Cmd_VPrintf(line, level, fmt, ap);
+    va_end(ap);
+}
+
+void Cmd_Redraw(Cmd_Line_t * line)
+{
+	if (line->notify == Cmd_Notify_Hidden)
 	{
-		// Find the first char
-		char ch = *head;
-		if (ch == ' ' || ch == '\t')
-		{
-			head++;
-		}
-		else if (ch == 0)
+		line->notify = Cmd_Notify_Shown;
+#ifdef CMD_PROMPT
+		if (line->cfg.prompt)
 		{
-			return Cmd_Token_Empty;
+			Cmd_Write(line, (uint8_t *)CMD_PROMPT, strlen(CMD_PROMPT));
 		}
-		else
+#endif //CMD_PROMPT
+#ifdef CMD_USE_ECHO
+		if (line->cfg.echo)
 		{
-			break;
+			Cmd_Write(line, (uint8_t *)line->bfr.data, line->bfr.index);
 		}
+#endif //CMD_USE_ECHO
 	}
-	char startc = *head;
-	if (startc == '"' || startc == '\'' || startc == '[' || startc == '<')
-	{
-		token->delimiter = startc;
-		if (startc == '<' || startc == '[')
-		{
-			// Close braces are always 2 chars after open.
-			startc += 2;
-		}
-		// Check if its a quoted token
-		head++;
-		token->str = head;
-		bool escaped = false;
-		while (1)
-		{
-			char ch = *head;
+}
+#endif //CMD_USE_NOTIFY
 
-			if (ch == 0)
-			{
-				return Cmd_Token_Broken;
+#ifdef CMD_USE_RECORDS
+void Cmd_BeginRecord(Cmd_Line_t * line, const char * name)
+{
+	line->record_fields = false;
+	switch (line->cfg.record)
+	{
+	case Cmd_Record_Json:
+		Cmd_WriteStr(line, "{\"");
+		Cmd_WriteStr(line, name);
+		Cmd_WriteStr(line, "\":{");
+		break;
+	case Cmd_Record_Cbor:
+		Cmd_WriteCborHead(line, CBOR_MAP, 1);
+		Cmd_WriteCborHead(line, CBOR_TEXT, strlen(name));
+		Cmd_WriteStr(line, name);
+		Cmd_WriteCborHead(line, CBOR_MAP_OPEN, 0);
+		break;
+	default:
+		Cmd_WriteStr(line, name);
+		break;
+	}
+}
+
+void Cmd_RecordNumber(Cmd_Line_t * line, const char * key, uint32_t value)
+{
+	Cmd_RecordKey(line, key);
+	if (line->cfg.record == Cmd_Record_Cbor)
+	{
+		Cmd_WriteCborHead(line, CBOR_UINT, value);
+	}
+	else
+	{
+		Cmd_WriteDecimal(line, value);
+	}
+}
+
+void Cmd_RecordBytes(Cmd_Line_t * line, const char * key, const uint8_t * data, uint32_t size)
+{
+	Cmd_RecordKey(line, key);
+	switch (line->cfg.record)
+	{
+	case Cmd_Record_Json:
+		Cmd_WriteStr(line, "\"");
+		Cmd_WriteHex(line, data, size);
+		Cmd_WriteStr(line, "\"");
+		break;
+	case Cmd_Record_Cbor:
+		Cmd_WriteCborHead(line, CBOR_BYTES, size);
+		Cmd_Write(line, data, size);
+		break;
+	default:
+		Cmd_WriteHex(line, data, size);
+		break;
+	}
+}
+
+void Cmd_RecordString(Cmd_Line_t * line, const char * key, const char * str)
+{
+	Cmd_RecordKey(line, key);
+	switch (line->cfg.record)
+	{
+	case Cmd_Record_Json:
+		Cmd_WriteJsonString(line, str);
+		break;
+	case Cmd_Record_Cbor:
+		Cmd_WriteCborHead(line, CBOR_TEXT, strlen(str));
+		Cmd_WriteStr(line, str);
+		break;
+	default:
+		Cmd_WriteStr(line, "'");
+		Cmd_WriteStr(line, str);
+		Cmd_WriteStr(line, "'");
+		break;
+	}
+}
+
+void Cmd_EndRecord(Cmd_Line_t * line)
+{
+	switch (line->cfg.record)
+	{
+	case Cmd_Record_Json:
+		Cmd_WriteStr(line, "}}" LF);
+		break;
+	case Cmd_Record_Cbor:
+		Cmd_WriteCborHead(line, CBOR_BREAK, 0);
+		break;
+	default:
+		Cmd_WriteStr(line, LF);
+		break;
+	}
+}
+#endif //CMD_USE_RECORDS
+
+#ifdef CMD_USE_REGISTERS
+bool Cmd_SetRegister(Cmd_Line_t * line, const char * name, uint32_t value)
+{
+	uint32_t size = strlen(name);
+	if (size == 0 || size >= CMD_REGISTER_NAME)
+	{
+		return false;
+	}
+	Cmd_Register_t * reg = Cmd_FindRegister(line, name);
+	if (reg == NULL)
+	{
+		// Take the first unused register.
+		reg = Cmd_FindRegister(line, "");
+		if (reg == NULL)
+		{
+			return false;
+		}
+		memcpy(reg->name, name, size + 1);
+	}
+	reg->value = value;
+	return true;
+}
+
+bool Cmd_GetRegister(Cmd_Line_t * line, const char * name, uint32_t * value)
+{
+	const Cmd_Register_t * reg = Cmd_FindRegister(line, name);
+	if (reg == NULL || name[0] == 0)
+	{
+		return false;
+	}
+	*value = reg->value;
+	return true;
+}
+#endif //CMD_USE_REGISTERS
+
+#ifdef CMD_USE_STREAM
+void Cmd_BeginStream(Cmd_Line_t * line, Cmd_Stream_t * stream)
+{
+	static const uint8_t header[] = { 'C', 'm', 'd', 'Z', CMD_STREAM_WINDOW - 1 };
+	stream->group[0] = 0;
+	stream->items = 0;
+	stream->fill = 1;
+	stream->pending = 0;
+	stream->length = 0;
+	stream->size = 0;
+	Cmd_Write(line, header, sizeof(header));
+}
+
+void Cmd_WriteStream(Cmd_Line_t * line, Cmd_Stream_t * stream, const uint8_t * data, uint32_t size)
+{
+	while (size--)
+	{
+		uint8_t ch = *data++;
+		stream->window[stream->size++ & STREAM_MASK] = ch;
+		if (stream->length)
+		{
+			// Extend the current match for as long as the data repeats.
+			if (stream->length < STREAM_MAX_MATCH && stream->window[(stream->size - 1 - stream->distance) & STREAM_MASK] == ch)
+			{
+				stream->length++;
+				continue;
+			}
+			if (stream->length < STREAM_MAX_MATCH && Cmd_StreamExtend(stream))
+			{
+				continue;
+			}
+			Cmd_StreamItem(line, stream, true, stream->distance - 1, stream->length - STREAM_MIN_MATCH);
+			stream->length = 0;
+		}
+		if (++stream->pending == STREAM_MIN_MATCH)
+		{
+			Cmd_StreamMatch(line, stream);
+		}
+	}
+}
+
+void Cmd_EndStream(Cmd_Line_t * line, Cmd_Stream_t * stream)
+{
+	if (stream->length)
+	{
+		Cmd_StreamItem(line, stream, true, stream->distance - 1, stream->length - STREAM_MIN_MATCH);
+	}
+	for (; stream->pending; stream->pending--)
+	{
+		Cmd_StreamItem(line, stream, false, stream->window[(stream->size - stream->pending) & STREAM_MASK], 0);
+	}
+	Cmd_StreamItem(line, stream, true, 0, STREAM_END);
+	if (stream->items)
+	{
+		Cmd_Write(line, stream->group, stream->fill);
+	}
+	uint32_t size = stream->size;
+	uint8_t trailer[] = { (uint8_t)size, (uint8_t)(size >> 8), (uint8_t)(size >> 16), (uint8_t)(size >> 24) };
+	Cmd_Write(line, trailer, sizeof(trailer));
+}
+#endif //CMD_USE_STREAM
+
+#ifdef CMD_USE_DUMP
+void Cmd_Dump(Cmd_Line_t * line, Cmd_DumpFormat_t format, const uint8_t * data, uint32_t size, uint32_t address)
+{
+	// Each row is written before the next is formatted. Any backpressure is applied by the capture flush, or the print function.
+	char bfr[DUMP_BFR_SIZE];
+	uint32_t row = format == Cmd_Dump_Base64 ? DUMP_BASE64_SIZE : format == Cmd_Dump_Hex ? DUMP_HEX_SIZE : DUMP_ROW_SIZE;
+	while (size)
+	{
+		uint32_t count = size < row ? size : row;
+		char * end;
+		switch (format)
+		{
+		case Cmd_Dump_Hex:
+			end = Cmd_DumpHex(bfr, data, count);
+			break;
+		case Cmd_Dump_Base64:
+			end = Cmd_DumpBase64(bfr, data, count);
+			break;
+		default:
+			end = Cmd_DumpRow(bfr, data, count, address);
+			break;
+		}
+		memcpy(end, LF, sizeof(LF) - 1);
+		end += sizeof(LF) - 1;
+		Cmd_Write(line, (uint8_t *)bfr, end - bfr);
+		data += count;
+		size -= count;
+		address += count;
+	}
+}
+#endif //CMD_USE_DUMP
+
+void * Cmd_Malloc(Cmd_Line_t * line, uint32_t size)
+{
+	if (Cmd_MemRemaining(line) < size)
+	{
+		CMD_TRACE(Cmd_Trace_Overrun, size);
+		Cmd_Prints(line, Cmd_Reply_Error, "MEMORY OVERRUN" LF);
+	}
+	// Ignore overrun and do it anyway.....
+	void * ptr = line->mem->head;
+	line->mem->head = (uint8_t *)ptr + size;
+	return ptr;
+}
+
+void Cmd_Free(Cmd_Line_t * line, void * ptr)
+{
+	if (ptr >= line->mem->heap)
+	{
+		line->mem->head = ptr;
+	}
+}
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static void Cmd_Write(Cmd_Line_t * line, const uint8_t * data, uint32_t size)
+{
+	Cmd_Capture_t * capture = line->capture;
+	if (capture != NULL)
+	{
+		while (size)
+		{
+			uint32_t space = capture->size - capture->count;
+			uint32_t count = size < space ? size : space;
+			memcpy(capture->data + capture->count, data, count);
+			capture->count += count;
+			data += count;
+			size -= count;
+			if (size)
+			{
+				if (capture->flush == NULL)
+				{
+					CMD_TRACE(Cmd_Trace_Discard, size);
+					break;
+				}
+				CMD_TRACE(Cmd_Trace_Flush, size);
+				capture->flush(capture);
+				if (capture->count == capture->size)
+				{
+					// The flush could not make any room.
+					CMD_TRACE(Cmd_Trace_Discard, size);
+					break;
+				}
+			}
+		}
+	}
+	else
+	{
+#ifdef CMD_USE_SESSION_LOG
+		if (line->session.write != NULL)
+		{
+			Cmd_SessionRecord(line, line->session.busy ? Cmd_Session_Output : Cmd_Session_Async, data, size);
+		}
+#endif
+		line->print(data, size);
+	}
+}
+
+static void Cmd_BeginReply(Cmd_Line_t * line, Cmd_ReplyLevel_t level)
+{
+	(void)line;
+	(void)level;
+#ifdef CMD_USE_COLOR
+	if (line->cfg.color)
+	{
+		switch (level)
+		{
+		case Cmd_Reply_Warn:
+			Cmd_Write(line, (uint8_t *)"\x00\x1b[33m", 6);
+			break;
+		case Cmd_Reply_Error:
+			Cmd_Write(line, (uint8_t *)"\x00\x1b[31m", 6);
+			break;
+		case Cmd_Reply_Info:
+			break;
+		}
+	}
+#endif //CMD_USE_COLOR
+}
+
+static void Cmd_VPrintf(Cmd_Line_t * line, Cmd_ReplyLevel_t level, const char * fmt, va_list ap)
+{
+#ifdef CMD_USE_VSNPRINTF
+    // Take whatevers left - because we will immediately free it.
+    uint32_t free = Cmd_MemRemaining(line);
+    char * bfr = Cmd_Malloc(line, free);
+    uint32_t written = vsnprintf(bfr, free, fmt, ap);
+    Cmd_Print(line, level, bfr, written);
+    Cmd_Free(line, bfr);
+#else
+    Cmd_BeginReply(line, level);
+    Cmd_Format(line, fmt, ap);
+    Cmd_EndReply(line, level);
+#endif
+}
+
+#ifdef CMD_USE_RECORDS
+static void Cmd_WriteStr(Cmd_Line_t * line, const char * str)
+{
+	Cmd_Write(line, (const uint8_t *)str, strlen(str));
+}
+
+static void Cmd_WriteDecimal(Cmd_Line_t * line, uint32_t value)
+{
+	char bfr[10];
+	char * head = bfr + sizeof(bfr);
+	do
+	{
+		*--head = '0' + (value % 10);
+		value /= 10;
+	} while (value);
+	Cmd_Write(line, (uint8_t *)head, bfr + sizeof(bfr) - head);
+}
+
+static void Cmd_WriteHex(Cmd_Line_t * line, const uint8_t * data, uint32_t size)
+{
+	// Written out in chunks, to keep the stack small.
+	static const char digits[] = "0123456789ABCDEF";
+	char bfr[16];
+	while (size)
+	{
+		uint32_t count = 0;
+		while (size && count < sizeof(bfr))
+		{
+			bfr[count++] = digits[*data >> 4];
+			bfr[count++] = digits[*data++ & 0xF];
+			size--;
+		}
+		Cmd_Write(line, (uint8_t *)bfr, count);
+	}
+}
+
+static void Cmd_WriteJsonString(Cmd_Line_t * line, const char * str)
+{
+	// Runs of plain chars are written whole. Quotes, backslashes and control chars are escaped.
+	static const char digits[] = "0123456789ABCDEF";
+	Cmd_WriteStr(line, "\"");
+	const char * run = str;
+	while (1)
+	{
+		uint8_t ch = *str;
+		if (ch == '"' || ch == '\\' || ch < ' ')
+		{
+			Cmd_Write(line, (const uint8_t *)run, str - run);
+			if (ch == 0)
+			{
+				break;
+			}
+			char esc[] = { '\\', 'u', '0', '0', digits[ch >> 4], digits[ch & 0xF] };
+			if (ch == '"' || ch == '\\')
+			{
+				esc[1] = ch;
+				Cmd_Write(line, (uint8_t *)esc, 2);
+			}
+			else
+			{
+				Cmd_Write(line, (uint8_t *)esc, sizeof(esc));
+			}
+			run = str + 1;
+		}
+		str++;
+	}
+	Cmd_WriteStr(line, "\"");
+}
+
+static void Cmd_WriteCborHead(Cmd_Line_t * line, uint8_t major, uint32_t value)
+{
+	// The argument follows the initial byte, big endian, in the smallest size that holds it.
+	uint8_t head[5];
+	uint32_t size;
+	if (major == CBOR_MAP_OPEN || major == CBOR_BREAK || value < 24)
+	{
+		head[0] = major | value;
+		size = 1;
+	}
+	else if (value <= 0xFF)
+	{
+		head[0] = major | 24;
+		size = 2;
+	}
+	else if (value <= 0xFFFF)
+	{
+		head[0] = major | 25;
+		size = 3;
+	}
+	else
+	{
+		head[0] = major | 26;
+		size = 5;
+	}
+	for (uint32_t i = size - 1; i > 0; i--)
+	{
+		head[i] = value;
+		value >>= 8;
+	}
+	Cmd_Write(line, head, size);
+}
+
+static void Cmd_RecordKey(Cmd_Line_t * line, const char * key)
+{
+	switch (line->cfg.record)
+	{
+	case Cmd_Record_Json:
+		Cmd_WriteStr(line, line->record_fields ? ",\"" : "\"");
+		Cmd_WriteStr(line, key);
+		Cmd_WriteStr(line, "\":");
+		break;
+	case Cmd_Record_Cbor:
+		Cmd_WriteCborHead(line, CBOR_TEXT, strlen(key));
+		Cmd_WriteStr(line, key);
+		break;
+	default:
+		Cmd_WriteStr(line, " ");
+		Cmd_WriteStr(line, key);
+		Cmd_WriteStr(line, "=");
+		break;
+	}
+	line->record_fields = true;
+}
+#endif //CMD_USE_RECORDS
+
+#ifdef CMD_USE_STREAM
+static void Cmd_StreamMatch(Cmd_Line_t * line, Cmd_Stream_t * stream)
+{
+	// Look for the nearest repeat of the pending bytes. Its source must not have been overwritten by the bytes after it.
+	const uint8_t * window = stream->window;
+	uint32_t start = stream->size - STREAM_MIN_MATCH;
+	uint32_t limit = start < CMD_STREAM_WINDOW - STREAM_MIN_MATCH ? start : CMD_STREAM_WINDOW - STREAM_MIN_MATCH;
+	uint8_t first = window[start & STREAM_MASK];
+	for (uint32_t distance = 1; distance <= limit; distance++)
+	{
+		uint32_t src = start - distance;
+		if (window[src & STREAM_MASK] == first
+				&& window[(src + 1) & STREAM_MASK] == window[(start + 1) & STREAM_MASK]
+				&& window[(src + 2) & STREAM_MASK] == window[(start + 2) & STREAM_MASK])
+		{
+			stream->distance = distance;
+			stream->length = STREAM_MIN_MATCH;
+			stream->pending = 0;
+			return;
+		}
+	}
+	// There is no match, so the oldest pending byte is a literal.
+	Cmd_StreamItem(line, stream, false, first, 0);
+	stream->pending--;
+}
+
+static bool Cmd_StreamExtend(Cmd_Stream_t * stream)
+{
+	// Look further back for a repeat of the whole match, including the byte that broke it.
+	// Both it and its source must still be within the window.
+	const uint8_t * window = stream->window;
+	uint32_t end = stream->size - 1;
+	uint32_t length = stream->length;
+	if (length + 1 >= CMD_STREAM_WINDOW)
+	{
+		return false;
+	}
+	uint32_t limit = end < CMD_STREAM_WINDOW - 1 ? end : CMD_STREAM_WINDOW - 1;
+	for (uint32_t distance = stream->distance + 1; distance + length <= limit; distance++)
+	{
+		uint32_t i = 0;
+		while (i <= length && window[(end - distance - i) & STREAM_MASK] == window[(end - i) & STREAM_MASK])
+		{
+			i++;
+		}
+		if (i > length)
+		{
+			stream->distance = distance;
+			stream->length++;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void Cmd_StreamItem(Cmd_Line_t * line, Cmd_Stream_t * stream, bool match, uint8_t a, uint8_t b)
+{
+	// Each flag bit marks whether the item is a literal byte, or a match of a distance and length byte.
+	uint8_t * group = stream->group;
+	group[stream->fill++] = a;
+	if (match)
+	{
+		group[0] |= 1 << stream->items;
+		group[stream->fill++] = b;
+	}
+	if (++stream->items == 8)
+	{
+		Cmd_Write(line, group, stream->fill);
+		group[0] = 0;
+		stream->items = 0;
+		stream->fill = 1;
+	}
+}
+#endif //CMD_USE_STREAM
+
+#ifdef CMD_USE_DUMP
+static char * Cmd_DumpRow(char * dst, const uint8_t * data, uint32_t count, uint32_t address)
+{
+	static const char digits[] = "0123456789ABCDEF";
+	for (int32_t shift = 28; shift >= 0; shift -= 4)
+	{
+		*dst++ = digits[(address >> shift) & 0xF];
+	}
+	*dst++ = ' ';
+	for (uint32_t i = 0; i < DUMP_ROW_SIZE; i++)
+	{
+		// A short final row is padded, so that its ASCII column lines up.
+		*dst++ = ' ';
+		if (i == DUMP_ROW_SIZE / 2)
+		{
+			*dst++ = ' ';
+		}
+		*dst++ = i < count ? digits[data[i] >> 4] : ' ';
+		*dst++ = i < count ? digits[data[i] & 0xF] : ' ';
+	}
+	*dst++ = ' ';
+	*dst++ = ' ';
+	*dst++ = '|';
+	for (uint32_t i = 0; i < count; i++)
+	{
+		char ch = data[i];
+		*dst++ = (ch >= ' ' && ch <= '~') ? ch : '.';
+	}
+	*dst++ = '|';
+	return dst;
+}
+
+static char * Cmd_DumpHex(char * dst, const uint8_t * data, uint32_t count)
+{
+	static const char digits[] = "0123456789ABCDEF";
+	while (count--)
+	{
+		*dst++ = digits[*data >> 4];
+		*dst++ = digits[*data++ & 0xF];
+	}
+	return dst;
+}
+
+static char * Cmd_DumpBase64(char * dst, const uint8_t * data, uint32_t count)
+{
+	static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	while (count)
+	{
+		// Each 3 bytes become 4 chars. A short group is padded with '='.
+		uint32_t group = count < 3 ? count : 3;
+		uint32_t bits = data[0] << 16;
+		if (group > 1) { bits |= data[1] << 8; }
+		if (group > 2) { bits |= data[2]; }
+		*dst++ = digits[(bits >> 18) & 0x3F];
+		*dst++ = digits[(bits >> 12) & 0x3F];
+		*dst++ = group > 1 ? digits[(bits >> 6) & 0x3F] : '=';
+		*dst++ = group > 2 ? digits[bits & 0x3F] : '=';
+		data += group;
+		count -= group;
+	}
+	return dst;
+}
+#endif //CMD_USE_DUMP
+
+static void Cmd_EndReply(Cmd_Line_t * line, Cmd_ReplyLevel_t level)
+{
+	(void)line;
+	(void)level;
+#ifdef CMD_USE_COLOR
+	if (line->cfg.color)
+	{
+		switch (level)
+		{
+		case Cmd_Reply_Warn:
+		case Cmd_Reply_Error:
+			Cmd_Write(line, (uint8_t *)"\x00\x1b[0m", 5);
+			break;
+		case Cmd_Reply_Info:
+			break;
+		}
+	}
+#endif //CMD_USE_COLOR
+#ifdef CMD_USE_BELL
+	if (level == Cmd_Reply_Error)
+	{
+		Cmd_Bell(line);
+	}
+#endif //CMD_USE_BELL
+}
+
+#ifndef CMD_USE_VSNPRINTF
+static void Cmd_Format(Cmd_Line_t * line, const char * fmt, va_list ap)
+{
+	// This supports the flags '-', '0' and ' ', a width, a precision for strings, and the 'l' length.
+	// The conversions are %d %i %u %x %X %p %s %c and %%. Pointers are written in full, with a 0x prefix.
+	// %H takes a uint32_t count followed by a pointer, and formats the bytes as hex. The ' ' flag spaces them.
+	Cmd_Formatter_t f;
+	f.line = line;
+	f.count = 0;
+
+	while (1)
+	{
+		char ch = *fmt++;
+		if (ch == 0)
+		{
+			break;
+		}
+		else if (ch != '%')
+		{
+			Cmd_FormatChar(&f, ch);
+			continue;
+		}
+
+		uint8_t flags = 0;
+		while (1)
+		{
+			ch = *fmt++;
+			if (ch == '-')			{ flags |= Cmd_Format_Left; }
+			else if (ch == '0')		{ flags |= Cmd_Format_Zero; }
+			else if (ch == ' ')		{ flags |= Cmd_Format_Space; }
+			else					{ break; }
+		}
+
+		uint32_t width = 0;
+		if (ch == '*')
+		{
+			width = va_arg(ap, int);
+			ch = *fmt++;
+		}
+		while (ch >= '0' && ch <= '9')
+		{
+			width = (width * 10) + (ch - '0');
+			ch = *fmt++;
+		}
+
+		uint32_t precision = UINT32_MAX;
+		if (ch == '.')
+		{
+			precision = 0;
+			ch = *fmt++;
+			if (ch == '*')
+			{
+				precision = va_arg(ap, int);
+				ch = *fmt++;
+			}
+			while (ch >= '0' && ch <= '9')
+			{
+				precision = (precision * 10) + (ch - '0');
+				ch = *fmt++;
+			}
+		}
+
+		while (ch == 'l' || ch == 'h' || ch == 'z')
+		{
+			if (ch == 'l')
+			{
+				flags |= Cmd_Format_Long;
+			}
+			ch = *fmt++;
+		}
+
+		switch (ch)
+		{
+		case 'd':
+		case 'i':
+		{
+			int32_t value = (flags & Cmd_Format_Long) ? (int32_t)va_arg(ap, long) : va_arg(ap, int);
+			char sign = value < 0 ? '-' : (flags & Cmd_Format_Space) ? ' ' : 0;
+			Cmd_FormatNumber(&f, value < 0 ? -(uint32_t)value : (uint32_t)value, 10, sign, "0123456789", width, flags);
+			break;
+		}
+		case 'u':
+		case 'x':
+		case 'X':
+		{
+			uint32_t value = (flags & Cmd_Format_Long) ? (uint32_t)va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
+			uint32_t base = ch == 'u' ? 10 : 16;
+			Cmd_FormatNumber(&f, value, base, 0, ch == 'x' ? "0123456789abcdef" : "0123456789ABCDEF", width, flags);
+			break;
+		}
+		case 'p':
+		{
+			// A pointer may be wider than a uint32_t, so its digits are written directly.
+			uintptr_t value = (uintptr_t)va_arg(ap, void *);
+			Cmd_FormatChar(&f, '0');
+			Cmd_FormatChar(&f, 'x');
+			for (int32_t shift = (sizeof(value) * 8) - 4; shift >= 0; shift -= 4)
+			{
+				Cmd_FormatChar(&f, "0123456789abcdef"[(value >> shift) & 0xF]);
 			}
-			else if (escaped)
+			break;
+		}
+		case 's':
+		{
+			const char * str = va_arg(ap, const char *);
+			uint32_t size = 0;
+			while (size < precision && str[size] != 0)
 			{
-				// Do not consider the following character as esc or end
-				escaped = false;
+				size++;
 			}
-			else if (ch == '\\')
+			Cmd_FormatField(&f, str, size, width, flags);
+			break;
+		}
+		case 'c':
+		{
+			char value = va_arg(ap, int);
+			Cmd_FormatField(&f, &value, 1, width, flags);
+			break;
+		}
+		case 'H':
+		{
+			uint32_t count = va_arg(ap, uint32_t);
+			const uint8_t * data = va_arg(ap, const uint8_t *);
+			Cmd_FormatHex(&f, data, count, flags);
+			break;
+		}
+		case 0:
+			// Do not run off the end of a truncated specifier.
+			fmt--;
+			break;
+		default:
+			Cmd_FormatChar(&f, ch);
+			break;
+		}
+	}
+	Cmd_Write(line, (uint8_t *)f.bfr, f.count);
+}
+
+static void Cmd_FormatChar(Cmd_Formatter_t * f, char ch)
+{
+	if (f->count >= sizeof(f->bfr))
+	{
+		Cmd_Write(f->line, (uint8_t *)f->bfr, f->count);
+		f->count = 0;
+	}
+	f->bfr[f->count++] = ch;
+}
+
+static void Cmd_FormatField(Cmd_Formatter_t * f, const char * str, uint32_t size, uint32_t width, uint8_t flags)
+{
+	uint32_t pad = width > size ? width - size : 0;
+	if (!(flags & Cmd_Format_Left))
+	{
+		while (pad)
+		{
+			Cmd_FormatChar(f, ' ');
+			pad--;
+		}
+	}
+	while (size--)
+	{
+		Cmd_FormatChar(f, *str++);
+	}
+	while (pad)
+	{
+		Cmd_FormatChar(f, ' ');
+		pad--;
+	}
+}
+
+static void Cmd_FormatNumber(Cmd_Formatter_t * f, uint32_t value, uint32_t base, char sign, const char * digits, uint32_t width, uint8_t flags)
+{
+	// Digits are generated from the end.
+	char bfr[11];
+	char * head = bfr + sizeof(bfr);
+	do
+	{
+		*--head = digits[value % base];
+		value /= base;
+	} while (value);
+
+	uint32_t size = (bfr + sizeof(bfr)) - head;
+	if (flags & Cmd_Format_Zero && !(flags & Cmd_Format_Left))
+	{
+		// The sign goes ahead of the zero padding.
+		if (sign)
+		{
+			Cmd_FormatChar(f, sign);
+			width = width ? width - 1 : 0;
+		}
+		while (width > size)
+		{
+			Cmd_FormatChar(f, '0');
+			width--;
+		}
+	}
+	else if (sign)
+	{
+		*--head = sign;
+		size++;
+	}
+	Cmd_FormatField(f, head, size, width, flags);
+}
+
+static void Cmd_FormatHex(Cmd_Formatter_t * f, const uint8_t * data, uint32_t count, uint8_t flags)
+{
+	static const char digits[] = "0123456789ABCDEF";
+	while (count--)
+	{
+		uint8_t byte = *data++;
+		Cmd_FormatChar(f, digits[byte >> 4]);
+		Cmd_FormatChar(f, digits[byte & 0xF]);
+		if (count && (flags & Cmd_Format_Space))
+		{
+			Cmd_FormatChar(f, ' ');
+		}
+	}
+}
+#endif //CMD_USE_VSNPRINTF
+
+static void Cmd_FreeAll(Cmd_Line_t * line)
+{
+	line->mem->head = line->mem->heap;
+}
+
+uint32_t Cmd_MemRemaining(Cmd_Line_t * line)
+{
+	int32_t rem = line->mem->size - ((uint8_t *)line->mem->head - (uint8_t *)line->mem->heap);
+	if (rem < 0) { return 0; }
+	return rem;
+}
+
+static Cmd_ArgValue_t * Cmd_MallocArgs(Cmd_Line_t * line, uint32_t count, uint32_t reserve)
+{
+	// The heap may have been left unaligned by strings.
+	// The reserve is kept free for anything that must be allocated after the values.
+	uintptr_t align = sizeof(void *);
+	uint32_t size = count * sizeof(Cmd_ArgValue_t) + align - 1;
+	if (Cmd_MemRemaining(line) < size + reserve)
+	{
+		// Unlike Cmd_Malloc, this is not forced, as the command can be cleanly refused.
+		CMD_TRACE(Cmd_Trace_Overrun, size);
+		Cmd_Prints(line, Cmd_Reply_Error, "MEMORY OVERRUN" LF);
+		return NULL;
+	}
+	uintptr_t bfr = (uintptr_t)Cmd_Malloc(line, size);
+	return (Cmd_ArgValue_t *)((bfr + align - 1) & ~(align - 1));
+}
+
+static Cmd_TokenStatus_t Cmd_ParseToken(const char ** str, Cmd_Token_t * token)
+{
+	const char * head = *str;
+	while (CMD_CHAR_CLASS(*head) & Cmd_Char_Space)
+	{
+		head++;
+	}
+	char startc = *head;
+	uint8_t cls = CMD_CHAR_CLASS(startc);
+	if (cls & Cmd_Char_End)
+	{
+		return Cmd_Token_Empty;
+	}
+	else if (cls & Cmd_Char_Quote)
+	{
+		token->delimiter = startc;
+		char endc = CMD_CHAR_CLOSE(startc);
+		head++;
+		token->str = head;
+		while (1)
+		{
+			// Plain chars are skipped with a single lookup each.
+			while (!(CMD_CHAR_CLASS(*head) & Cmd_Char_Stop))
 			{
-				escaped = true;
+				head++;
 			}
-			else if (ch == startc)
+			char ch = *head;
+			if (ch == endc)
 			{
 				break;
 			}
+			else if (ch == 0)
+			{
+				return Cmd_Token_Broken;
+			}
+			else if (ch == '\\')
+			{
+				// Do not consider the following character as esc or end
+				head++;
+				if (*head == 0)
+				{
+					return Cmd_Token_Broken;
+				}
+			}
 			head++;
 		}
 
@@ -417,13 +1749,8 @@ static Cmd_TokenStatus_t Cmd_ParseToken(const char ** str, Cmd_Token_t * token)
 	{
 		token->delimiter = 0;
 		token->str = head;
-		while (1)
+		while (!(CMD_CHAR_CLASS(*head) & (Cmd_Char_Space | Cmd_Char_End)))
 		{
-			char ch = *head;
-			if (ch == ' ' || ch == '\t' || ch == 0)
-			{
-				break;
-			}
 			head++;
 		}
 
@@ -451,16 +1778,37 @@ static Cmd_TokenStatus_t Cmd_NextToken(Cmd_Line_t * line, const char ** str, Cmd
 
 static bool Cmd_ParseArg(Cmd_Line_t * line, const Cmd_Arg_t * arg, Cmd_ArgValue_t * value, Cmd_Token_t * token)
 {
+	(void)line;
 	const char * str = token->str;
+#ifdef CMD_USE_REGISTERS
+	// An unquoted "$name" is substituted with the register value, without going back through text.
+	bool reg = token->delimiter == 0 && str[0] == '$';
+#endif
 	switch (arg->type & Cmd_Arg_Mask)
 	{
 	case Cmd_Arg_Number:
+#ifdef CMD_USE_REGISTERS
+		if (reg)
+		{
+			return Cmd_GetRegister(line, str + 1, &value->number);
+		}
+#endif
 		return Cmd_ParseNumber(&str, &value->number) && (*str == 0);
 #ifdef CMD_USE_BOOL_ARGS
 	case Cmd_Arg_Bool:
 	{
 		uint32_t n;
-		bool success = Cmd_ParseNumber(&str, &n) && (*str == 0);
+		bool success;
+#ifdef CMD_USE_REGISTERS
+		if (reg)
+		{
+			success = Cmd_GetRegister(line, str + 1, &n);
+		}
+		else
+#endif
+		{
+			success = Cmd_ParseNumber(&str, &n) && (*str == 0);
+		}
 		value->boolean = n;
 		return success;
 	}
@@ -469,14 +1817,39 @@ static bool Cmd_ParseArg(Cmd_Line_t * line, const Cmd_Arg_t * arg, Cmd_ArgValue_
 	case Cmd_Arg_Bytes:
 	{
 		uint32_t maxbytes = token->size + 1;
-		uint8_t * bfr = Cmd_Malloc(line, maxbytes);
+		uint8_t * bfr;
+#ifdef CMD_USE_BYTE_SINKS
+		const Cmd_ByteSink_t * sink = arg->sink;
+		if (sink != NULL)
+		{
+			if (sink->alloc != NULL)
+			{
+				bfr = sink->alloc(line, maxbytes);
+			}
+			else
+			{
+				bfr = sink->data;
+				maxbytes = sink->size;
+			}
+			if (bfr == NULL)
+			{
+				return false;
+			}
+		}
+		else
+#endif //CMD_USE_BYTE_SINKS
+		{
+			bfr = Cmd_Malloc(line, maxbytes);
+		}
 		value->bytes.data = bfr;
+#ifdef CMD_USE_STRING_ARGS
 		char delim = token->delimiter;
 		if (delim == '"' || delim == '\'')
 		{
 			return Cmd_ParseString(&str, (char *)bfr, maxbytes, &value->bytes.size) && (*str == 0);
 		}
 		else
+#endif //CMD_USE_STRING_ARGS
 		{
 			return Cmd_ParseBytes(&str, bfr, maxbytes, &value->bytes.size) && (*str == 0);
 		}
@@ -491,11 +1864,63 @@ static bool Cmd_ParseArg(Cmd_Line_t * line, const Cmd_Arg_t * arg, Cmd_ArgValue_
 		return Cmd_ParseString(&str, bfr, maxbytes, &maxbytes) && (*str == 0);
 	}
 #endif //CMD_USE_STRING_ARGS
+#ifdef CMD_USE_LIST_ARGS
+	case Cmd_Arg_List32:
+	case Cmd_Arg_List16:
+	case Cmd_Arg_List8:
+	{
+		// Each number takes at least one char, and a separator.
+		uint32_t width = Cmd_ListWidth(arg->type);
+		uint32_t maxcount = token->size / 2 + 1;
+		uintptr_t bfr = (uintptr_t)Cmd_Malloc(line, maxcount * width + width - 1);
+		value->list.u8 = (uint8_t *)((bfr + width - 1) & ~(uintptr_t)(width - 1));
+		return Cmd_ParseList(&str, value->list.u8, width, maxcount, &value->list.count);
+	}
+#endif //CMD_USE_LIST_ARGS
+#ifdef CMD_USE_CHOICE_ARGS
+	case Cmd_Arg_Choice:
+	{
+		const Cmd_Choices_t * choices = arg->choices;
+		int32_t n = Cmd_FindName((const void * const *)choices->names, false, choices->count, choices->index, str, token->size);
+		value->number = n;
+		return n >= 0;
+	}
+#endif //CMD_USE_CHOICE_ARGS
 	default:
 		return false;
 	}
 }
 
+#ifdef CMD_USE_LIST_ARGS
+static uint32_t Cmd_ListWidth(uint8_t type)
+{
+	switch (type & Cmd_Arg_Mask)
+	{
+	case Cmd_Arg_List8:
+		return sizeof(uint8_t);
+	case Cmd_Arg_List16:
+		return sizeof(uint16_t);
+	default:
+		return sizeof(uint32_t);
+	}
+}
+#endif
+
+#ifdef CMD_USE_REGISTERS
+static Cmd_Register_t * Cmd_FindRegister(Cmd_Line_t * line, const char * name)
+{
+	for (uint32_t i = 0; i < CMD_REGISTER_COUNT; i++)
+	{
+		Cmd_Register_t * reg = &line->registers[i];
+		if (strncmp(reg->name, name, CMD_REGISTER_NAME) == 0)
+		{
+			return reg;
+		}
+	}
+	return NULL;
+}
+#endif
+
 static const char * Cmd_ArgTypeStr_Internal(uint8_t type)
 {
 	switch (type)
@@ -513,6 +1938,18 @@ static const char * Cmd_ArgTypeStr_Internal(uint8_t type)
 #ifdef CMD_USE_STRING_ARGS
 	case Cmd_Arg_String:
 		return "string";
+#endif
+#ifdef CMD_USE_LIST_ARGS
+	case Cmd_Arg_List32:
+		return "list";
+	case Cmd_Arg_List16:
+		return "list16";
+	case Cmd_Arg_List8:
+		return "list8";
+#endif
+#ifdef CMD_USE_CHOICE_ARGS
+	case Cmd_Arg_Choice:
+		return "choice";
 #endif
 	default:
 		return "UNKNOWN";
@@ -521,49 +1958,257 @@ static const char * Cmd_ArgTypeStr_Internal(uint8_t type)
 
 static const char * Cmd_ArgTypeStr(Cmd_Line_t * line, const Cmd_Arg_t * arg)
 {
-	if (arg->type & Cmd_Arg_Optional)
+	// Optional arguments are suffixed with '?', and variadic arguments with "...".
+	const char * str = Cmd_ArgTypeStr_Internal(arg->type & Cmd_Arg_Mask);
+	const char * suffix = (arg->type & Cmd_Arg_Optional) ? "?" : "";
+#ifdef CMD_USE_VARIADIC_ARGS
+	if (arg->type & Cmd_Arg_Variadic)
+	{
+		suffix = (arg->type & Cmd_Arg_Optional) ? "?..." : "...";
+	}
+#endif
+	if (*suffix)
 	{
-		const char * str = Cmd_ArgTypeStr_Internal(arg->type & Cmd_Arg_Mask);
 		uint32_t size = strlen(str);
-		char * bfr = Cmd_Malloc(line, size + 2);
+		uint32_t extra = strlen(suffix);
+		char * bfr = Cmd_Malloc(line, size + extra + 1);
 		memcpy(bfr, str, size);
-		bfr[size] = '?';
-		bfr[size + 1] = 0;
+		memcpy(bfr + size, suffix, extra + 1);
 		return bfr;
 	}
-	return Cmd_ArgTypeStr_Internal(arg->type);
+	return str;
+}
+
+static int32_t Cmd_CompareName(const char * name, const char * str, uint32_t size)
+{
+	int32_t cmp = strncmp(name, str, size);
+	if (cmp == 0)
+	{
+		// A longer name sorts after the token it starts with
+		cmp = (uint8_t)name[size];
+	}
+	return cmp;
+}
+
+static const Cmd_Node_t * Cmd_FindNode(Cmd_Line_t * line, const Cmd_Node_t * node, const char * str, uint32_t size, uint32_t * selection)
+{
+	if (node->type == Cmd_Node_Dynamic)
+	{
+		// The resolver expects a null terminated name.
+		char * name = Cmd_Malloc(line, size + 1);
+		memcpy(name, str, size);
+		name[size] = 0;
+		uint32_t index = 0;
+		const Cmd_Node_t * child = node->dynamic.resolve(line, name, &index);
+		Cmd_Free(line, name);
+		if (child != NULL && selection != NULL)
+		{
+			*selection = index;
+		}
+		return child;
+	}
+
+	int32_t n = Cmd_FindName((const void * const *)node->menu.nodes, true, node->menu.count, node->menu.index, str, size);
+	return n >= 0 ? node->menu.nodes[n] : NULL;
+}
+
+static int32_t Cmd_FindName(const void * const * items, bool nodes, uint32_t count, const uint8_t * index, const char * str, uint32_t size)
+{
+	// The items are either nodes, or the names themselves. Returns the position of the match, or -1.
+#define ITEM_NAME(_n)	(nodes ? ((const Cmd_Node_t *)items[_n])->name : (const char *)items[_n])
+	if (index != NULL)
+	{
+		uint32_t low = 0;
+		uint32_t high = count;
+		while (low < high)
+		{
+			uint32_t mid = (low + high) / 2;
+			int32_t cmp = Cmd_CompareName(ITEM_NAME(index[mid]), str, size);
+			if (cmp == 0)
+			{
+				return index[mid];
+			}
+			else if (cmp < 0)
+			{
+				low = mid + 1;
+			}
+			else
+			{
+				high = mid;
+			}
+		}
+		return -1;
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (Cmd_CompareName(ITEM_NAME(i), str, size) == 0)
+		{
+			return i;
+		}
+	}
+	return -1;
+#undef ITEM_NAME
+}
+
+#if defined(CMD_HELP_TOKEN) || defined(CMD_USE_TABCOMPLETE)
+static const char * Cmd_ChildName(Cmd_Line_t * line, const Cmd_Node_t * node, uint32_t n, char * bfr)
+{
+	// The buffer is only used by dynamic menus, and must be CMD_MAX_LINE long.
+	if (node->type == Cmd_Node_Dynamic)
+	{
+		return node->dynamic.enumerate(line, n, bfr, CMD_MAX_LINE) ? bfr : NULL;
+	}
+	return n < node->menu.count ? node->menu.nodes[n]->name : NULL;
+}
+#endif
+
+static const Cmd_Node_t * Cmd_FindFunction(Cmd_Line_t * line, const char * str, const char ** args, uint32_t * selection)
+{
+	// Tokens are consumed from the string until a function is found. Its arguments are what remains.
+	const Cmd_Node_t * node = line->root;
+	while (IS_MENU(node))
+	{
+		Cmd_Token_t token;
+		switch(Cmd_NextToken(line, &str, &token))
+		{
+		case Cmd_Token_Empty:
+			Cmd_Printf(line, Cmd_Reply_Error, "<menu: %s> is not a function" LF, node->name);
+			return NULL;
+		case Cmd_Token_Broken:
+			Cmd_Prints(line, Cmd_Reply_Error, "Incomplete token found" LF);
+			return NULL;
+		case Cmd_Token_Ok:
+			break;
+		}
+		const Cmd_Node_t * selected = Cmd_FindNode(line, node, token.str, token.size, selection);
+		if (selected == NULL)
+		{
+			Cmd_Printf(line, Cmd_Reply_Error, "'%s' is not an item within <menu: %s>" LF, token.str, node->name);
+			return NULL;
+		}
+		node = selected;
+	}
+	*args = str;
+	return node;
+}
+
+#ifdef CMD_USE_MENU_POOLS
+static uint32_t Cmd_PoolPosition(const Cmd_MenuPool_t * pool, const char * name)
+{
+	// The first position in the index whose name does not sort before this one.
+	uint32_t size = strlen(name);
+	uint32_t low = 0;
+	uint32_t high = pool->node.menu.count;
+	while (low < high)
+	{
+		uint32_t mid = (low + high) / 2;
+		if (Cmd_CompareName(pool->slots[pool->index[mid]]->name, name, size) < 0)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+	return low;
+}
+#endif
+
+static void Cmd_ResetParse(Cmd_Line_t * line)
+{
+	line->parse.node = line->root;
+	line->parse.start = 0;
+	line->parse.halt = 0;
+}
+
+static void Cmd_TrackParse(Cmd_Line_t * line, uint32_t from)
+{
+	// Resolve any tokens completed by the chars from this index onwards.
+	for (uint32_t i = from; i < line->bfr.index; i++)
+	{
+		if (CMD_CHAR_CLASS(line->bfr.data[i]) & Cmd_Char_Space)
+		{
+			Cmd_ResolveToken(line, i);
+		}
+	}
+}
+
+static void Cmd_ResolveToken(Cmd_Line_t * line, uint32_t end)
+{
+	const Cmd_Node_t * node = line->parse.node;
+	if (line->parse.halt || !IS_MENU(node) || node->type == Cmd_Node_Dynamic)
+	{
+		// Anything beyond this point is left for the full parse.
+		// Dynamic menus are resolved when the line is run, so that the selection is made for it.
+		return;
+	}
+
+	const char * str = line->bfr.data;
+	uint32_t start = line->parse.start;
+	while (start < end && (CMD_CHAR_CLASS(str[start]) & Cmd_Char_Space))
+	{
+		start++;
+	}
+	if (start == end)
+	{
+		return;
+	}
+
+	const Cmd_Node_t * child = NULL;
+	if (!(CMD_CHAR_CLASS(str[start]) & Cmd_Char_Quote))
+	{
+		// Quoted tokens may contain whitespace, so are never resolved early.
+		child = Cmd_FindNode(line, node, str + start, end - start, NULL);
+	}
+
+	if (child != NULL)
+	{
+		CMD_TRACE(Cmd_Trace_Node, child);
+		line->parse.node = child;
+		line->parse.start = end;
+	}
+	else
+	{
+		line->parse.halt = end;
+	}
 }
 
 static void Cmd_Run(Cmd_Line_t * line, const Cmd_Node_t * node, const char * str)
 {
-	switch (node->type)
+	// Menus are descended in a loop, so that the stack use does not grow with the depth of the tree.
+	while (IS_MENU(node))
 	{
-	case Cmd_Node_Menu:
-		Cmd_RunMenu(line, node, str);
-		break;
-	case Cmd_Node_Function:
-		Cmd_RunFunction(line, node, str);
-		break;
+		node = Cmd_RunMenu(line, node, &str);
+		if (node == NULL)
+		{
+			return;
+		}
 	}
+	Cmd_RunFunction(line, node, str);
 }
 
-static void Cmd_RunRoot(Cmd_Line_t * line, const char * str)
+static void Cmd_RunRoot(Cmd_Line_t * line)
 {
-	Cmd_Run(line, line->root, str);
+	// Any tokens before the parse start have already been resolved.
+	line->selection = 0;
+	Cmd_Run(line, line->parse.node, line->bfr.data + line->parse.start);
 	Cmd_FreeAll(line);
 }
 
-static void Cmd_RunMenu(Cmd_Line_t * line, const Cmd_Node_t * node, const char * str)
+static const Cmd_Node_t * Cmd_RunMenu(Cmd_Line_t * line, const Cmd_Node_t * node, const char ** str)
 {
+	// Returns the selected node, or NULL if the line has been handled.
 	Cmd_Token_t token;
-	switch(Cmd_NextToken(line, &str, &token))
+	switch(Cmd_NextToken(line, str, &token))
 	{
 	case Cmd_Token_Empty:
 		Cmd_Printf(line, Cmd_Reply_Info, "<menu: %s>" LF, node->name);
-		return;
+		return NULL;
 	case Cmd_Token_Broken:
 		Cmd_Prints(line, Cmd_Reply_Error, "Incomplete token found" LF);
-		return;
+		return NULL;
 	case Cmd_Token_Ok:
 		break; // Continue execution.
 	}
@@ -572,36 +2217,36 @@ static void Cmd_RunMenu(Cmd_Line_t * line, const Cmd_Node_t * node, const char *
 	if (strcmp(CMD_HELP_TOKEN, token.str) == 0)
 	{
 		Cmd_PrintMenuHelp(line, node);
+		return NULL;
 	}
-	else
 #endif //CMD_HELP_TOKEN
+
+	const Cmd_Node_t * selected = Cmd_FindNode(line, node, token.str, token.size, &line->selection);
+	if (selected == NULL)
 	{
-		const Cmd_Node_t * selected = NULL;
-		for (uint32_t i = 0; i < node->menu.count; i++)
-		{
-			const Cmd_Node_t * child = node->menu.nodes[i];
-			if (strcmp(child->name, token.str) == 0)
-			{
-				selected = child;
-				break;
-			}
-		}
-		if (selected == NULL)
-		{
-			Cmd_Printf(line, Cmd_Reply_Error, "'%s' is not an item within <menu: %s>" LF, token.str, node->name);
-		}
-		else
-		{
-			// we may as well free this token before we run the next menu.
-			Cmd_Free(line, (void*)token.str);
-			Cmd_Run(line, selected, str);
-		}
+		Cmd_Printf(line, Cmd_Reply_Error, "'%s' is not an item within <menu: %s>" LF, token.str, node->name);
+		return NULL;
 	}
+	// we may as well free this token before we run the next menu.
+	CMD_TRACE(Cmd_Trace_Node, selected);
+	Cmd_Free(line, (void*)token.str);
+	return selected;
 }
 
 static void Cmd_RunFunction(Cmd_Line_t * line, const Cmd_Node_t * node, const char * str)
 {
-	Cmd_ArgValue_t args[CMD_MAX_ARGS + 1]; // We will parse an extra as a test.
+	// The args are sized to the function, so that functions with many do not cost every command stack.
+	Cmd_ArgValue_t * args = Cmd_MallocArgs(line, node->func.arglen, 0);
+	if (args != NULL && Cmd_ParseArgs(line, node, str, args))
+	{
+		CMD_TRACE(Cmd_Trace_Enter, node);
+		node->func.callback(line, args);
+		CMD_TRACE(Cmd_Trace_Exit, node);
+	}
+}
+
+static bool Cmd_ParseArgs(Cmd_Line_t * line, const Cmd_Node_t * node, const char * str, Cmd_ArgValue_t * args)
+{
 	uint32_t argn = 0;
 
 	Cmd_Token_t token;
@@ -611,7 +2256,7 @@ static void Cmd_RunFunction(Cmd_Line_t * line, const Cmd_Node_t * node, const ch
 	if (tstat == Cmd_Token_Ok && strcmp(CMD_HELP_TOKEN, token.str) == 0)
 	{
 		Cmd_PrintFunctionHelp(line, node);
-		return;
+		return false;
 	}
 #endif
 
@@ -621,6 +2266,19 @@ static void Cmd_RunFunction(Cmd_Line_t * line, const Cmd_Node_t * node, const ch
 
 		if (tstat == Cmd_Token_Ok)
 		{
+#ifdef CMD_USE_VARIADIC_ARGS
+			if (arg->type & Cmd_Arg_Variadic)
+			{
+				if (argn + 1 < node->func.arglen)
+				{
+					// Any following arguments could never be given.
+					Cmd_Printf(line, Cmd_Reply_Error, "<func: %s> may only have a variadic last argument" LF, node->name);
+					return false;
+				}
+				// This takes all remaining tokens, so there is nothing left to check.
+				return Cmd_ParseVariadic(line, arg, argn, args + argn, str, &token);
+			}
+#endif
 			if (Cmd_ParseArg(line, arg, args + argn, &token))
 			{
 				args[argn].present = true;
@@ -641,49 +2299,366 @@ static void Cmd_RunFunction(Cmd_Line_t * line, const Cmd_Node_t * node, const ch
 		else
 		{
 			Cmd_Prints(line, Cmd_Reply_Error, "Incomplete token found" LF);
-			return;
+			return false;
 		}
 
 		// Parse failed or blank token found.
+		CMD_TRACE(Cmd_Trace_ArgError, argn + 1);
 		Cmd_Printf(line, Cmd_Reply_Error, "Argument %d is <%s: %s>" LF, argn+1, Cmd_ArgTypeStr(line, arg), arg->name);
-		return;
+		return false;
 	}
 	for (; argn < node->func.arglen; argn++)
 	{
 		// Any remaining nodes are not present.
 		args[argn].present = false;
+#ifdef CMD_USE_VARIADIC_ARGS
+		// So that callbacks can iterate over the values regardless.
+		args[argn].variadic.count = 0;
+#endif
 	}
 
 	if (tstat != Cmd_Token_Empty)
 	{
 		Cmd_Printf(line, Cmd_Reply_Error, "<func: %s> takes maximum %d arguments" LF, node->name, node->func.arglen);
+		return false;
 	}
-	else
+	return true;
+}
+
+#ifdef CMD_USE_VARIADIC_ARGS
+static bool Cmd_ParseVariadic(Cmd_Line_t * line, const Cmd_Arg_t * arg, uint32_t argn, Cmd_ArgValue_t * value, const char * str, Cmd_Token_t * token)
+{
+	// The remaining tokens are counted without copying them, so that exactly enough values are allocated.
+	uint32_t count = 1;
+	const char * head = str;
+	Cmd_Token_t next;
+	Cmd_TokenStatus_t tstat;
+	while ((tstat = Cmd_ParseToken(&head, &next)) == Cmd_Token_Ok)
 	{
-		node->func.callback(line, args);
+		count++;
+	}
+	if (tstat != Cmd_Token_Empty)
+	{
+		Cmd_Prints(line, Cmd_Reply_Error, "Incomplete token found" LF);
+		return false;
+	}
+
+	// The remaining tokens are copied after the values, and each needs a null char.
+	Cmd_ArgValue_t * values = Cmd_MallocArgs(line, count, (head - str) + count);
+	if (values == NULL)
+	{
+		return false;
+	}
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (i > 0)
+		{
+			Cmd_NextToken(line, &str, token);
+		}
+		if (!Cmd_ParseArg(line, arg, values + i, token))
+		{
+			CMD_TRACE(Cmd_Trace_ArgError, argn + i + 1);
+			Cmd_Printf(line, Cmd_Reply_Error, "Argument %d is <%s: %s>" LF, argn + i + 1, Cmd_ArgTypeStr(line, arg), arg->name);
+			return false;
+		}
+		values[i].present = true;
+	}
+	value->variadic.count = count;
+	value->variadic.values = values;
+	value->present = true;
+	return true;
+}
+#endif //CMD_USE_VARIADIC_ARGS
+
+#ifdef CMD_USE_REPEAT
+static void Cmd_RepeatFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args)
+{
+	Cmd_Binding_t binding;
+	if (Cmd_Bind(line, &binding, args[1].str))
+	{
+		for (uint32_t i = 0; i < args[0].number; i++)
+		{
+			Cmd_Invoke(line, &binding);
+		}
+	}
+}
+
+static void Cmd_EveryFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args)
+{
+	Cmd_StopEvery(line);
+	if (args[0].number && args[1].present)
+	{
+		Cmd_Binding_t * binding = &line->every.binding;
+		if (Cmd_Bind(line, binding, args[1].str) && Cmd_KeepBinding(line, binding))
+		{
+			line->every.period = args[0].number;
+			// The first invocation will occur on the next tick.
+			line->every.last = line->every.now - args[0].number;
+		}
+		else
+		{
+			Cmd_StopEvery(line);
+		}
+	}
+}
+
+static void Cmd_StopEvery(Cmd_Line_t * line)
+{
+	line->every.binding.node = NULL;
+	Cmd_Kept_t * kept = line->every.kept;
+	if (kept == NULL)
+	{
+		return;
+	}
+	line->every.kept = NULL;
+	if (line->every.running && line->every.stale == NULL)
+	{
+		// The first binding stopped while running is the one in use. Any later are not yet in use.
+		line->every.stale = kept;
+		return;
+	}
+	Cmd_ReleaseKept(line->mem, kept);
+}
+
+static void Cmd_ReleaseKept(Cmd_Heap_t * mem, Cmd_Kept_t * kept)
+{
+	kept->held = false;
+
+	// Other lines sharing the heap may hold reservations below this one.
+	// The heap is returned up to the lowest reservation that is still held.
+	uint32_t top = mem->end;
+	uint32_t size = mem->end;
+	while (top > mem->size)
+	{
+		uint32_t offset = Cmd_KeptHeader(mem, top);
+		kept = (Cmd_Kept_t *)((uint8_t *)mem->heap + offset);
+		top = offset - kept->size;
+		if (kept->held)
+		{
+			size = top;
+		}
+	}
+	mem->size = size;
+}
+
+static bool Cmd_KeepBinding(Cmd_Line_t * line, Cmd_Binding_t * binding)
+{
+	// The argument data must outlive this command, so it is moved to the top of the heap.
+	// The heap is shrunk to protect it until the binding is stopped.
+	if (Cmd_MemRemaining(line) < sizeof(Cmd_Kept_t) + sizeof(uint32_t) - 1)
+	{
+		Cmd_Prints(line, Cmd_Reply_Error, "MEMORY OVERRUN" LF);
+		return false;
+	}
+	uint32_t offset = Cmd_KeptHeader(line->mem, line->mem->size);
+	Cmd_Kept_t * kept = (Cmd_Kept_t *)((uint8_t *)line->mem->heap + offset);
+	kept->size = 0;
+	kept->held = true;
+	line->mem->size = offset;
+	line->every.kept = kept;
+
+	for (uint32_t argn = 0; argn < binding->node->func.arglen; argn++)
+	{
+		const Cmd_Arg_t * arg = &binding->node->func.args[argn];
+		Cmd_ArgValue_t * value = &binding->args[argn];
+		if (!value->present)
+		{
+			continue;
+		}
+#ifdef CMD_USE_VARIADIC_ARGS
+		if (arg->type & Cmd_Arg_Variadic)
+		{
+			// The data of each value is kept, and then the values themselves.
+			for (uint32_t i = 0; i < value->variadic.count; i++)
+			{
+				if (!Cmd_KeepValue(line, arg, value->variadic.values + i))
+				{
+					return false;
+				}
+			}
+			if (!Cmd_KeepData(line, (uint8_t **)&value->variadic.values, value->variadic.count * sizeof(Cmd_ArgValue_t), sizeof(void *)))
+			{
+				return false;
+			}
+			continue;
+		}
+#endif
+		if (!Cmd_KeepValue(line, arg, value))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool Cmd_KeepValue(Cmd_Line_t * line, const Cmd_Arg_t * arg, Cmd_ArgValue_t * value)
+{
+	uint8_t type = arg->type & Cmd_Arg_Mask;
+#ifdef CMD_USE_BYTE_SINKS
+	if (type == Cmd_Arg_Bytes && arg->sink != NULL)
+	{
+		// Data in a sink is already outside of the heap.
+		return true;
+	}
+#endif
+#ifdef CMD_USE_BYTE_ARGS
+	if (type == Cmd_Arg_Bytes)
+	{
+		return Cmd_KeepData(line, &value->bytes.data, value->bytes.size, 1);
+	}
+#endif
+#ifdef CMD_USE_STRING_ARGS
+	if (type == Cmd_Arg_String)
+	{
+		return Cmd_KeepData(line, (uint8_t **)&value->str, strlen(value->str) + 1, 1);
+	}
+#endif
+#ifdef CMD_USE_LIST_ARGS
+	if (type == Cmd_Arg_List32 || type == Cmd_Arg_List16 || type == Cmd_Arg_List8)
+	{
+		uint32_t width = Cmd_ListWidth(type);
+		return Cmd_KeepData(line, &value->list.u8, value->list.count * width, width);
+	}
+#endif
+	// Anything else is held within the value.
+	return true;
+}
+
+static bool Cmd_KeepData(Cmd_Line_t * line, uint8_t ** data, uint32_t size, uint32_t align)
+{
+	if (Cmd_MemRemaining(line) < size + align - 1)
+	{
+		Cmd_Prints(line, Cmd_Reply_Error, "MEMORY OVERRUN" LF);
+		return false;
 	}
+	uint8_t * top = (uint8_t *)line->mem->heap + line->mem->size;
+	uint8_t * dst = (uint8_t *)((uintptr_t)(top - size) & ~(uintptr_t)(align - 1));
+	line->mem->size = dst - (uint8_t *)line->mem->heap;
+	((Cmd_Kept_t *)line->every.kept)->size += top - dst;
+	memcpy(dst, *data, size);
+	*data = dst;
+	return true;
 }
 
+static uint32_t Cmd_KeptHeader(Cmd_Heap_t * mem, uint32_t top)
+{
+	// Returns the offset of the header placed below the given offset.
+	uintptr_t header = ((uintptr_t)mem->heap + top - sizeof(Cmd_Kept_t)) & ~(uintptr_t)(sizeof(uint32_t) - 1);
+	return header - (uintptr_t)mem->heap;
+}
+#endif //CMD_USE_REPEAT
+
 #ifdef CMD_HELP_TOKEN
 static void Cmd_PrintMenuHelp(Cmd_Line_t * line, const Cmd_Node_t * node)
 {
-	Cmd_Printf(line, Cmd_Reply_Info, "<menu: %s> contains %d nodes:" LF, node->name, node->menu.count);
-	for (uint32_t i = 0; i < node->menu.count; i++)
+	char * bfr = node->type == Cmd_Node_Dynamic ? Cmd_Malloc(line, CMD_MAX_LINE) : NULL;
+	uint32_t count = 0;
+	while (Cmd_ChildName(line, node, count, bfr) != NULL)
+	{
+		count++;
+	}
+#ifdef CMD_USE_HELP_TEXT
+	Cmd_PrintHelpText(line, "", node->help);
+#endif
+	Cmd_Printf(line, Cmd_Reply_Info, "<menu: %s> contains %d nodes:" LF, node->name, count);
+	for (uint32_t i = 0; i < count; i++)
 	{
-		const Cmd_Node_t * child = node->menu.nodes[i];
-		Cmd_Printf(line, Cmd_Reply_Info, " - %s" LF, child->name);
+#ifdef CMD_USE_HELP_TEXT
+		if (node->type == Cmd_Node_Menu && node->menu.nodes[i]->help != NULL)
+		{
+			Cmd_Printf(line, Cmd_Reply_Info, " - %s", node->menu.nodes[i]->name);
+			Cmd_PrintHelpText(line, ": ", node->menu.nodes[i]->help);
+			continue;
+		}
+#endif
+		Cmd_Printf(line, Cmd_Reply_Info, " - %s" LF, Cmd_ChildName(line, node, i, bfr));
 	}
 }
 
 static void Cmd_PrintFunctionHelp(Cmd_Line_t * line, const Cmd_Node_t * node)
 {
+#ifdef CMD_USE_HELP_TEXT
+	Cmd_PrintHelpText(line, "", node->help);
+#endif
 	Cmd_Printf(line, Cmd_Reply_Info, "<func: %s> takes %d arguments:" LF, node->name, node->func.arglen);
 	for (uint32_t argn = 0; argn < node->func.arglen; argn++)
 	{
 		const Cmd_Arg_t * arg = &node->func.args[argn];
-		Cmd_Printf(line, Cmd_Reply_Info, " - <%s: %s>" LF, Cmd_ArgTypeStr(line, arg), arg->name);
+#ifdef CMD_USE_HELP_TEXT
+		if (arg->help != NULL)
+		{
+			Cmd_Printf(line, Cmd_Reply_Info, " - <%s: %s>", Cmd_ArgTypeStr(line, arg), arg->name);
+			Cmd_PrintHelpText(line, ": ", arg->help);
+		}
+		else
+#endif
+		{
+			Cmd_Printf(line, Cmd_Reply_Info, " - <%s: %s>" LF, Cmd_ArgTypeStr(line, arg), arg->name);
+		}
+#ifdef CMD_USE_CHOICE_ARGS
+		if ((arg->type & Cmd_Arg_Mask) == Cmd_Arg_Choice)
+		{
+			Cmd_PrintChoices(line, arg->choices);
+		}
+#endif
+	}
+}
+
+#ifdef CMD_USE_CHOICE_ARGS
+static void Cmd_PrintChoices(Cmd_Line_t * line, const Cmd_Choices_t * choices)
+{
+	Cmd_Prints(line, Cmd_Reply_Info, "   one of:");
+	for (uint32_t i = 0; i < choices->count; i++)
+	{
+		Cmd_Printf(line, Cmd_Reply_Info, " %s", choices->names[i]);
+	}
+	Cmd_Prints(line, Cmd_Reply_Info, LF);
+}
+#endif
+
+#ifdef CMD_USE_HELP_TEXT
+static void Cmd_PrintHelpText(Cmd_Line_t * line, const char * prefix, const uint8_t * help)
+{
+	// The description is expanded in chunks, so that it is never held whole in RAM.
+	// Bytes with the top bit set refer to a dictionary entry, which ends on a char with its top bit set.
+	if (help == NULL)
+	{
+		return;
+	}
+	char bfr[HELP_BFR_SIZE];
+	uint32_t count = strlen(prefix);
+	memcpy(bfr, prefix, count);
+	uint8_t code;
+	while ((code = *help++) != 0)
+	{
+		const uint8_t * entry = NULL;
+		if (code & HELP_CODE)
+		{
+			entry = Cmd_HelpDictionary;
+			for (uint32_t n = code & ~HELP_CODE; n > 0; n--)
+			{
+				while (!(*entry++ & HELP_CODE));
+			}
+		}
+		uint8_t ch = code;
+		do
+		{
+			if (entry != NULL)
+			{
+				ch = *entry++;
+			}
+			if (count == sizeof(bfr))
+			{
+				Cmd_Write(line, (uint8_t *)bfr, count);
+				count = 0;
+			}
+			bfr[count++] = ch & ~HELP_CODE;
+		} while (entry != NULL && !(ch & HELP_CODE));
 	}
+	Cmd_Write(line, (uint8_t *)bfr, count);
+	Cmd_Write(line, (uint8_t *)LF, strlen(LF));
 }
+#endif //CMD_USE_HELP_TEXT
 #endif //CMD_HELP_TOKEN
 
 #ifdef CMD_USE_ANSI
@@ -753,13 +2728,13 @@ static void Cmd_ClearLine(Cmd_Line_t * line)
 		uint32_t size = line->bfr.index;
 		char * bfr = Cmd_Malloc(line, size);
 		memset(bfr, DEL, size);
-		line->print((uint8_t *)bfr, size);
+		Cmd_Write(line, (uint8_t *)bfr, size);
 		Cmd_Free(line, bfr);
 	}
 #endif //CMD_USE_ECHO
 	line->bfr.recall_index = line->bfr.index;
 	line->bfr.index = 0;
-
+	Cmd_ResetParse(line);
 }
 
 static void Cmd_RecallLine(Cmd_Line_t * line)
@@ -767,81 +2742,277 @@ static void Cmd_RecallLine(Cmd_Line_t * line)
 #ifdef CMD_USE_ECHO
 	if (line->cfg.echo)
 	{
-		line->print( (uint8_t *)(line->bfr.data + line->bfr.index), line->bfr.recall_index - line->bfr.index);
+		Cmd_Write(line, (uint8_t *)(line->bfr.data + line->bfr.index), line->bfr.recall_index - line->bfr.index);
 	}
 #endif //CMD_USE_ECHO
+	uint32_t index = line->bfr.index;
 	line->bfr.index = line->bfr.recall_index;
+	// The recalled chars follow on from what remains of the line.
+	Cmd_TrackParse(line, index);
 }
 #endif //CMD_USE_ANSI
 
+#ifdef CMD_USE_NOTIFY
+static void Cmd_HideLine(Cmd_Line_t * line)
+{
+	// Captured output is not on the terminal, so there is nothing to erase. Flushed captures are passed on to it.
+	if (line->notify == Cmd_Notify_Shown && (line->capture == NULL || line->capture->flush != NULL))
+	{
+		line->notify = Cmd_Notify_Hidden;
+		bool shown = false;
+#ifdef CMD_PROMPT
+		shown |= line->cfg.prompt;
+#endif
+#ifdef CMD_USE_ECHO
+		shown |= line->cfg.echo && line->bfr.index;
+#endif
+		if (shown)
+		{
+#ifdef CMD_USE_ANSI
+			// Return to the start of the line, and erase to its end.
+			Cmd_Write(line, (uint8_t *)"\r\x1b[K", 4);
+#else
+			// The terminal may not support the erase sequence, so the line is left as it is.
+			Cmd_Write(line, (uint8_t *)LF, sizeof(LF) - 1);
+#endif
+		}
+	}
+}
+#endif //CMD_USE_NOTIFY
+
 #ifdef CMD_USE_BELL
 static void Cmd_Bell(Cmd_Line_t * line)
 {
 	if (line->cfg.bell)
 	{
 		uint8_t ch = '\a';
-		line->print(&ch, 1);
+		Cmd_Write(line, &ch, 1);
 	}
 }
 #endif //CMD_USE_BELL
 
 #ifdef CMD_USE_TABCOMPLETE
-static const char * Cmd_TabComplete(Cmd_Line_t * line, const char * str)
+static void Cmd_TabComplete(Cmd_Line_t * line)
 {
-	const char * append = Cmd_TabCompleteMenu(line, line->root, str);
+	const char * append = NULL;
+	const Cmd_Node_t * node = line->parse.node;
+#ifndef CMD_USE_CHOICE_ARGS
+	// Without choices, there is nothing to complete within the arguments of a function.
+	if (IS_MENU(node))
+#endif
+	{
+		// Only the unresolved remainder of the line needs to be considered.
+		line->bfr.data[line->bfr.index] = 0;
+		append = Cmd_TabCompleteMenu(line, node, line->bfr.data + line->parse.start);
+	}
+
+	uint32_t append_count = append != NULL ? strlen(append) : 0;
+	if (append_count && line->bfr.index + append_count < line->bfr.size)
+	{
+		// A tab complete should not overflow the line buffer.
+		uint32_t index = line->bfr.index;
+		memcpy(line->bfr.data + index, append, append_count);
+		line->bfr.index += append_count;
+		line->bfr.recall_index = line->bfr.index;
+		Cmd_TrackParse(line, index);
+		Cmd_Write(line, (uint8_t *)append, append_count);
+	}
+#ifdef CMD_USE_BELL
+	else if (append == NULL)
+	{
+		Cmd_Bell(line);
+	}
+#endif //CMD_USE_BELL
 	Cmd_FreeAll(line);
-	return append;
 }
 
 static const char * Cmd_TabCompleteMenu(Cmd_Line_t * line, const Cmd_Node_t * node, const char * str)
 {
+	// Menus are descended in a loop, so that the stack use does not grow with the depth of the tree.
 	Cmd_Token_t token;
-	if (Cmd_NextToken(line, &str, &token) == Cmd_Token_Ok)
+	while (IS_MENU(node) && Cmd_NextToken(line, &str, &token) == Cmd_Token_Ok)
 	{
 		bool end = *str == 0;
 
 		if (end)
 		{
-			const Cmd_Node_t * candidate = NULL;
-			for (uint32_t i = 0; i < node->menu.count; i++)
+			// Dynamic names are enumerated into a buffer, so the candidate needs a buffer of its own.
+			char * bfr = NULL;
+			char * spare = NULL;
+			if (node->type == Cmd_Node_Dynamic)
+			{
+				bfr = Cmd_Malloc(line, CMD_MAX_LINE);
+				spare = Cmd_Malloc(line, CMD_MAX_LINE);
+			}
+			const char * candidate = NULL;
+			const char * name;
+			for (uint32_t i = 0; (name = Cmd_ChildName(line, node, i, bfr)) != NULL; i++)
 			{
-				const Cmd_Node_t * child = node->menu.nodes[i];
 				// Check if the token matches so far
-				if (strncmp(child->name, token.str, token.size) == 0)
+				if (strncmp(name, token.str, token.size) == 0)
 				{
 					if (candidate != NULL)
 					{
 						// There are more than one candidates. No decision can be made.
 						return NULL;
 					}
-					candidate = child;
+					candidate = name;
+					if (name == bfr)
+					{
+						bfr = spare;
+					}
 				}
 			}
 			if (candidate != NULL)
 			{
-				return candidate->name + token.size;
+				return candidate + token.size;
 			}
+			return NULL;
 		}
-		else
+
+		node = Cmd_FindNode(line, node, token.str, token.size, NULL);
+		if (node == NULL)
+		{
+			return NULL;
+		}
+	}
+#ifdef CMD_USE_CHOICE_ARGS
+	if (!IS_MENU(node))
+	{
+		return Cmd_TabCompleteArgs(line, node, str);
+	}
+#endif
+	return NULL;
+}
+
+#ifdef CMD_USE_CHOICE_ARGS
+static const char * Cmd_TabCompleteArgs(Cmd_Line_t * line, const Cmd_Node_t * node, const char * str)
+{
+	// Only the last token may be completed, and only if it is a choice.
+	Cmd_Token_t token;
+	uint32_t arglen = node->func.arglen;
+#ifdef CMD_USE_VARIADIC_ARGS
+	if (arglen && (node->func.args[arglen - 1].type & Cmd_Arg_Variadic))
+	{
+		// The last argument takes any number of tokens.
+		arglen = UINT32_MAX;
+	}
+#endif
+	for (uint32_t argn = 0; argn < arglen && Cmd_NextToken(line, &str, &token) == Cmd_Token_Ok; argn++)
+	{
+		if (*str != 0)
+		{
+			continue;
+		}
+		const Cmd_Arg_t * arg = &node->func.args[argn < node->func.arglen ? argn : node->func.arglen - 1];
+		if ((arg->type & Cmd_Arg_Mask) != Cmd_Arg_Choice)
+		{
+			return NULL;
+		}
+		const char * candidate = NULL;
+		for (uint32_t i = 0; i < arg->choices->count; i++)
 		{
-			for (uint32_t i = 0; i < node->menu.count; i++)
+			const char * name = arg->choices->names[i];
+			if (strncmp(name, token.str, token.size) == 0)
 			{
-				const Cmd_Node_t * child = node->menu.nodes[i];
-				if (strcmp(child->name, token.str) == 0)
+				if (candidate != NULL)
 				{
-					if (child->type == Cmd_Node_Menu)
-					{
-						return Cmd_TabCompleteMenu(line, child, str);
-					}
+					// There are more than one candidates. No decision can be made.
 					return NULL;
 				}
+				candidate = name;
 			}
 		}
+		return candidate != NULL ? candidate + token.size : NULL;
 	}
 	return NULL;
 }
+#endif
 #endif //CMD_USE_TABCOMPLETE
 
+#ifdef CMD_USE_TRACE
+static void Cmd_Trace(uint8_t type, uint32_t arg)
+{
+	Cmd_TraceEvent_t * event = &gTrace.events[gTrace.index++ & (CMD_TRACE_SIZE - 1)];
+	event->time = CMD_TRACE_TIME();
+	event->event = type | (arg << 8);
+}
+
+static void Cmd_TraceShowFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args)
+{
+	(void)args;
+	// Take a snapshot of the index, as printing may record more events.
+	uint32_t end = gTrace.index;
+	uint32_t count = end < CMD_TRACE_SIZE ? end : CMD_TRACE_SIZE;
+	for (uint32_t i = end - count; i != end; i++)
+	{
+		const Cmd_TraceEvent_t * event = &gTrace.events[i & (CMD_TRACE_SIZE - 1)];
+		uint8_t type = event->event & 0xFF;
+		uint32_t arg = event->event >> 8;
+		const char * name = type < LENGTH(gTraceNames) ? gTraceNames[type] : "?";
+		if (type == Cmd_Trace_Node || type == Cmd_Trace_Enter || type == Cmd_Trace_Exit)
+		{
+			Cmd_Printf(line, Cmd_Reply_Info, "%u %s 0x%06X" LF, event->time, name, arg);
+		}
+		else
+		{
+			Cmd_Printf(line, Cmd_Reply_Info, "%u %s %u" LF, event->time, name, arg);
+		}
+	}
+}
+
+static void Cmd_TraceDumpFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args)
+{
+	(void)args;
+	uint32_t end = gTrace.index;
+	uint32_t count = end < CMD_TRACE_SIZE ? end : CMD_TRACE_SIZE;
+	Cmd_Write(line, (uint8_t *)"CmdT", 4);
+	Cmd_Write(line, (uint8_t *)&count, sizeof(count));
+	// The ring may be written out in two parts, oldest first.
+	uint32_t start = (end - count) & (CMD_TRACE_SIZE - 1);
+	uint32_t first = CMD_TRACE_SIZE - start < count ? CMD_TRACE_SIZE - start : count;
+	Cmd_Write(line, (uint8_t *)&gTrace.events[start], first * sizeof(Cmd_TraceEvent_t));
+	Cmd_Write(line, (uint8_t *)gTrace.events, (count - first) * sizeof(Cmd_TraceEvent_t));
+}
+
+static void Cmd_TraceClearFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args)
+{
+	(void)line;
+	(void)args;
+	gTrace.index = 0;
+}
+#endif //CMD_USE_TRACE
+
+#ifdef CMD_USE_SESSION_LOG
+static void Cmd_SessionRecord(Cmd_Line_t * line, uint8_t type, const uint8_t * data, uint32_t size)
+{
+	uint32_t now = CMD_SESSION_TIME();
+	uint8_t head[SESSION_HEAD_SIZE];
+	uint8_t * dst = head;
+	*dst++ = type;
+	dst = Cmd_SessionVarint(dst, now - line->session.last);
+	dst = Cmd_SessionVarint(dst, size);
+	line->session.last = now;
+	line->session.write(head, dst - head);
+	if (data != NULL && size)
+	{
+		line->session.write(data, size);
+	}
+}
+
+static uint8_t * Cmd_SessionVarint(uint8_t * dst, uint32_t value)
+{
+	// 7 bits at a time, least significant first. The top bit is set on all but the last byte.
+	while (value >= 0x80)
+	{
+		*dst++ = (uint8_t)value | 0x80;
+		value >>= 7;
+	}
+	*dst++ = (uint8_t)value;
+	return dst;
+}
+#endif //CMD_USE_SESSION_LOG
+
 /*
  * INTERRUPT ROUTINES
  */
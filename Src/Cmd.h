@@ -5,6 +5,10 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /*
  * PUBLIC DEFINITIONS
  */
@@ -18,6 +22,16 @@
 		.name = _name					\
 	}
 
+#ifdef CMD_USE_BYTE_SINKS
+// A bytes argument that is decoded directly into the sink, rather than onto the heap.
+#define CMD_SINK_ARGUMENT(_type, _name, _sink) \
+	{									\
+		.type = _type,					\
+		.name = _name,					\
+		.sink = _sink					\
+	}
+#endif
+
 #define CMD_FUNCTION(_name, _callback)	\
 	{									\
 		.type = Cmd_Node_Function, 		\
@@ -49,6 +63,119 @@
 		}								\
 	}
 
+#ifdef CMD_USE_CHOICE_ARGS
+// A choice argument, which is resolved to the index of the matching name.
+#define CMD_CHOICE_ARGUMENT(_type, _name, _choices) \
+	{									\
+		.type = _type,					\
+		.name = _name,					\
+		.choices = _choices				\
+	}
+
+#define CMD_CHOICES(_names)				\
+	{									\
+		.names = _names,				\
+		.count = LENGTH(_names)			\
+	}
+
+// The index lists the positions of the names in sorted order, as for CMD_IMENU.
+#define CMD_ICHOICES(_names, _index)	\
+	{									\
+		.names = _names,				\
+		.count = LENGTH(_names),		\
+		.index = _index					\
+	}
+#endif
+
+#ifdef CMD_USE_HELP_TEXT
+// As above, with a description generated by Tools/cmd_help.py.
+#define CMD_ARGUMENT_HELP(_type, _name, _help) \
+	{									\
+		.type = _type,					\
+		.name = _name,					\
+		.help = _help					\
+	}
+
+#define CMD_FUNCTION_HELP(_name, _callback, _help) \
+	{									\
+		.type = Cmd_Node_Function, 		\
+		.name = _name,					\
+		.help = _help,					\
+		.func = {						\
+			.callback = _callback,		\
+			.arglen = 0					\
+		} 								\
+	}
+
+#define CMD_AFUNCTION_HELP(_name, _callback, _arglist, _help) \
+	{									\
+		.type = Cmd_Node_Function, 		\
+		.name = _name,					\
+		.help = _help,					\
+		.func = {						\
+			.callback = _callback,		\
+			.args = _arglist,			\
+			.arglen = LENGTH(_arglist)	\
+		} 								\
+	}
+
+#define CMD_MENU_HELP(_name, _nodelist, _help) \
+	{									\
+		.type = Cmd_Node_Menu,			\
+		.name = _name,					\
+		.help = _help,					\
+		.menu = {						\
+			.nodes = _nodelist,			\
+			.count = LENGTH(_nodelist)	\
+		}								\
+	}
+#endif
+
+// The children of a dynamic menu are resolved from their names on demand, rather than being stored.
+// The enumerator is used to list the names for help and tab completion.
+// The resolver may return a shared child, and writes an index to tell the selections apart.
+// When a command is run, the index from the last dynamic menu on its path is held in line->selection.
+#define CMD_DYNAMIC(_name, _resolve, _enumerate)	\
+	{									\
+		.type = Cmd_Node_Dynamic,		\
+		.name = _name,					\
+		.dynamic = {					\
+			.resolve = _resolve,		\
+			.enumerate = _enumerate		\
+		}								\
+	}
+
+// The index lists the positions of the nodes in order of their names, so that they may be binary searched.
+#define CMD_IMENU(_name, _nodelist, _index)	\
+	{									\
+		.type = Cmd_Node_Menu,			\
+		.name = _name,					\
+		.menu = {						\
+			.nodes = _nodelist,			\
+			.count = LENGTH(_nodelist),	\
+			.index = _index				\
+		}								\
+	}
+
+#ifdef CMD_USE_MENU_POOLS
+// A menu with no children until they are attached. The slots and index should be arrays of the same length, at most 256.
+#define CMD_MENU_POOL(_name, _slots, _index) \
+	{									\
+		.node = {						\
+			.type = Cmd_Node_Menu,		\
+			.name = _name,				\
+			.menu = {					\
+				.nodes = _slots,		\
+				.count = 0,				\
+				.index = _index			\
+			}							\
+		},								\
+		.slots = _slots,				\
+		.index = _index,				\
+		.size = LENGTH(_slots)			\
+	}
+#endif
+
 /*
  * PUBLIC TYPES
  */
@@ -64,13 +191,55 @@ typedef enum {
 #ifdef CMD_USE_STRING_ARGS
 	Cmd_Arg_String,
 #endif
-	Cmd_Arg_Mask = 0x7F,
+#ifdef CMD_USE_LIST_ARGS
+	Cmd_Arg_List32,
+	Cmd_Arg_List16,
+	Cmd_Arg_List8,
+#endif
+#ifdef CMD_USE_CHOICE_ARGS
+	Cmd_Arg_Choice,
+#endif
+	Cmd_Arg_Mask = 0x3F,
+#ifdef CMD_USE_VARIADIC_ARGS
+	Cmd_Arg_Variadic = 0x40,	// The last argument takes all remaining tokens. Combine with Cmd_Arg_Optional to allow none.
+#endif
 	Cmd_Arg_Optional = 0x80,
 } Cmd_ArgType_t;
 
+#ifdef CMD_USE_RECORDS
+typedef enum {
+	Cmd_Record_Text,	// name key=1 data=0A0B text='hi'
+	Cmd_Record_Json,	// {"name":{"key":1,"data":"0A0B","text":"hi"}}
+	Cmd_Record_Cbor,	// A map of the name to an indefinite length map of the fields
+} Cmd_RecordFormat_t;
+#endif
+
+#ifdef CMD_USE_DUMP
+typedef enum {
+	Cmd_Dump_Rows,		// 00000010  48 65 6C 6C 6F 0A 00 00  ...  |Hello...|
+	Cmd_Dump_Hex,		// 48656C6C6F0A0000...
+	Cmd_Dump_Base64,	// SGVsbG8KAAA...
+} Cmd_DumpFormat_t;
+#endif
+
+#ifdef CMD_USE_STREAM
+// The state of a compressed stream. This may be placed on the stack of the command writing it.
+typedef struct {
+	uint8_t window[CMD_STREAM_WINDOW];
+	uint8_t group[17];	// A flag byte, and up to 8 literals or 2 byte matches
+	uint8_t items;		// The number of items in the group
+	uint8_t fill;		// The number of bytes in the group
+	uint8_t pending;	// The number of bytes at the end of the window that are not yet encoded
+	uint16_t distance;	// The current match, if its length is not 0
+	uint16_t length;
+	uint32_t size;		// The total number of bytes written
+} Cmd_Stream_t;
+#endif
+
 typedef enum {
 	Cmd_Node_Function,
 	Cmd_Node_Menu,
+	Cmd_Node_Dynamic,
 } Cmd_NodeType_t;
 
 typedef enum {
@@ -82,12 +251,44 @@ typedef enum {
 typedef struct Cmd_Node_s Cmd_Node_t;
 typedef struct Cmd_Line_s Cmd_Line_t;
 
+#ifdef CMD_USE_BYTE_SINKS
+// Either the alloc function, or the fixed data region is used.
+typedef struct {
+	// Returns a buffer of at least the requested size, or NULL to reject the argument.
+	// The size is an upper bound of the decoded length, and includes space for a null char.
+	uint8_t * (*alloc)(Cmd_Line_t * line, uint32_t size);
+	uint8_t * data;
+	uint32_t size;
+} Cmd_ByteSink_t;
+#endif
+
+#ifdef CMD_USE_CHOICE_ARGS
+typedef struct {
+	const char * const * names;
+	uint32_t count;
+	const uint8_t * index; // Optional
+} Cmd_Choices_t;
+#endif
+
 typedef struct {
 	const char * name;
 	uint8_t type; // Cmd_ArgType_t
+#if defined(CMD_USE_BYTE_SINKS) || defined(CMD_USE_CHOICE_ARGS)
+	union {
+#ifdef CMD_USE_BYTE_SINKS
+		const Cmd_ByteSink_t * sink; // Optional, for bytes
+#endif
+#ifdef CMD_USE_CHOICE_ARGS
+		const Cmd_Choices_t * choices; // Required, for choices
+#endif
+	};
+#endif
+#ifdef CMD_USE_HELP_TEXT
+	const uint8_t * help; // Optional
+#endif
 } Cmd_Arg_t;
 
-typedef struct {
+typedef struct Cmd_ArgValue_s {
 	union {
 		uint32_t number;
 #ifdef CMD_USE_BOOL_ARGS
@@ -101,6 +302,22 @@ typedef struct {
 #endif
 #ifdef CMD_USE_STRING_ARGS
 		const char * str;
+#endif
+#ifdef CMD_USE_LIST_ARGS
+		struct {
+			uint32_t count;
+			union {
+				uint32_t * u32;
+				uint16_t * u16;
+				uint8_t * u8;
+			};
+		}list;
+#endif
+#ifdef CMD_USE_VARIADIC_ARGS
+		struct {
+			uint32_t count;
+			struct Cmd_ArgValue_s * values;
+		}variadic;
 #endif
 	};
 	bool present;
@@ -109,19 +326,113 @@ typedef struct {
 typedef struct Cmd_Node_s {
 	const char * name;
 	uint8_t type; // Cmd_NodeType_t
+#ifdef CMD_USE_HELP_TEXT
+	const uint8_t * help; // Optional
+#endif
 	union {
 		struct {
-			const Cmd_Node_t ** nodes;
+			const Cmd_Node_t * const * nodes;
 			uint32_t count;
+			const uint8_t * index; // Optional
 		}menu;
 		struct {
 			const Cmd_Arg_t * args;
 			uint32_t arglen;
 			void (*callback)(Cmd_Line_t * line, Cmd_ArgValue_t * argv);
 		}func;
+		struct {
+			// Returns the child with this name, or NULL if there is none. The index is written for the callback.
+			// This may also be called for help and tab completion, so should not have side effects.
+			const Cmd_Node_t * (*resolve)(Cmd_Line_t * line, const char * name, uint32_t * index);
+			// Writes the name of the nth child into the buffer. Returns false if there is no nth child.
+			bool (*enumerate)(Cmd_Line_t * line, uint32_t n, char * bfr, uint32_t size);
+		}dynamic;
 	};
 } Cmd_Node_t;
 
+#ifdef CMD_USE_MENU_POOLS
+// The node is added to the tree as any other menu. Its children are held in the slots, and the index keeps them sorted by name.
+typedef struct {
+	Cmd_Node_t node;
+	const Cmd_Node_t ** slots;
+	uint8_t * index;
+	uint32_t size;
+} Cmd_MenuPool_t;
+#endif
+
+// A scratch heap for arguments and formatting. This may be shared by lines that run on the same thread.
+typedef struct {
+	void * heap;
+	uint32_t size;
+	void * head;
+#ifdef CMD_USE_REPEAT
+	uint32_t end;		// The size before any was reserved by bindings
+#endif
+} Cmd_Heap_t;
+
+// A buffer that output may be redirected into.
+typedef struct Cmd_Capture_s {
+	uint8_t * data;
+	uint32_t size;
+	uint32_t count;
+	// Optional. Called when the buffer is full, and should empty it. Otherwise excess output is discarded.
+	void (*flush)(struct Cmd_Capture_s * capture);
+} Cmd_Capture_t;
+
+#ifdef CMD_USE_TRACE
+typedef enum {
+	Cmd_Trace_Line,		// A line was received. The arg is its length.
+	Cmd_Trace_Node,		// A node was resolved. The arg is its address.
+	Cmd_Trace_ArgError,	// An argument could not be parsed. The arg is its position.
+	Cmd_Trace_Enter,	// A callback was entered. The arg is the address of its node.
+	Cmd_Trace_Exit,		// A callback returned. The arg is the address of its node.
+	Cmd_Trace_Overrun,	// The heap was overrun. The arg is the requested size.
+	Cmd_Trace_Flush,	// A full capture was flushed. The arg is the number of bytes waiting.
+	Cmd_Trace_Discard,	// Output was discarded by a full capture. The arg is the number of bytes lost.
+} Cmd_TraceType_t;
+
+// The event holds the type in its low 8 bits, and the arg in the upper 24 bits. Addresses are truncated to 24 bits.
+typedef struct {
+	uint32_t time;
+	uint32_t event;
+} Cmd_TraceEvent_t;
+#endif
+
+#ifdef CMD_USE_REGISTERS
+// A named number published by a callback. An empty name marks an unused register.
+typedef struct {
+	char name[CMD_REGISTER_NAME];
+	uint32_t value;
+} Cmd_Register_t;
+#endif
+
+#ifdef CMD_USE_SESSION_LOG
+// The log starts with "CmdS", a version byte, a byte of Cmd_SessionFlag_t, and the uint32_t heap size.
+// Each record is then a Cmd_SessionRecord_t byte, followed by the time since the previous record and the size as varints.
+// The data follows input and output records. The size of a tick record is the time passed to Cmd_Tick.
+// Output written outside of Cmd_Parse and Cmd_Tick, such as by Cmd_Log, is recorded as asynchronous.
+typedef enum {
+	Cmd_Session_Input,
+	Cmd_Session_Output,
+	Cmd_Session_Tick,
+	Cmd_Session_Async,
+} Cmd_SessionRecord_t;
+
+typedef enum {
+	Cmd_Session_Color = (1 << 0),
+	Cmd_Session_Bell = (1 << 1),
+	Cmd_Session_Echo = (1 << 2),
+	Cmd_Session_Prompt = (1 << 3),
+} Cmd_SessionFlag_t;
+#endif
+
+// A function node with its arguments already parsed, ready to be invoked.
+typedef struct {
+	const Cmd_Node_t * node;
+	uint32_t selection;	// The index from the last dynamic menu on the path
+	Cmd_ArgValue_t args[CMD_MAX_ARGS];
+} Cmd_Binding_t;
+
 typedef struct
 {
 #ifdef CMD_USE_COLOR
@@ -136,6 +447,9 @@ typedef struct
 #ifdef CMD_PROMPT
 		bool prompt;
 #endif
+#ifdef CMD_USE_RECORDS
+		uint8_t record; // Cmd_RecordFormat_t
+#endif
 } Cmd_LineConfig_t;
 
 typedef struct Cmd_Line_s {
@@ -145,20 +459,74 @@ typedef struct Cmd_Line_s {
 		char * data;
 		uint32_t recall_index;
 	}bfr;
+	struct {
+		const Cmd_Node_t * node;	// The deepest node resolved by completed tokens
+		uint32_t start;				// Offset of the unresolved remainder of the line
+		uint32_t halt;				// Offset of the token end that failed to resolve, or 0
+	}parse;
 	void (*print)(const uint8_t * data, uint32_t size);
+	Cmd_Capture_t * capture;
 	const Cmd_Node_t * root;
-	struct {
-		void * heap;
-		uint32_t size;
-		void * head;
-	}mem;
+	Cmd_Heap_t * mem;
 	Cmd_LineConfig_t cfg;
+	uint32_t selection;	// The index from the last dynamic menu on the path of the running command
 	char last_ch;
 #ifdef CMD_USE_ANSI
 	uint8_t ansi; // Cmd_AnsiState_t
 #endif
+#ifdef CMD_USE_NOTIFY
+	uint8_t notify; // Cmd_NotifyState_t
+#endif
+#ifdef CMD_USE_RECORDS
+	bool record_fields; // The current record has fields
+#endif
+#ifdef CMD_USE_REGISTERS
+	Cmd_Register_t registers[CMD_REGISTER_COUNT];
+#endif
+#ifdef CMD_USE_SESSION_LOG
+	struct {
+		void (*write)(const uint8_t * data, uint32_t size);
+		uint32_t last;		// The time of the previous record
+		bool busy;			// Within Cmd_Parse or Cmd_Tick
+	}session;
+#endif
+#ifdef CMD_USE_REPEAT
+	struct {
+		Cmd_Binding_t binding;
+		uint32_t period;
+		uint32_t last;
+		uint32_t now;
+		void * kept;		// The header of the heap reserved for the binding arguments
+		void * stale;		// The header of a binding stopped while it ran, which is released once it returns
+		bool running;
+	}every;
+#endif
 } Cmd_Line_t;
 
+/*
+ * PUBLIC VARIABLES
+ */
+
+#ifdef CMD_USE_REPEAT
+// Built in commands that may be added to any menu.
+// repeat <count> <command>: Runs the quoted command count times, only parsing it once.
+// every <period> <command>: Runs the quoted command each period, as measured by Cmd_Tick. A period of 0 stops it.
+extern const Cmd_Node_t Cmd_RepeatNode;
+extern const Cmd_Node_t Cmd_EveryNode;
+#endif
+
+#ifdef CMD_USE_TRACE
+// trace show: Prints the recorded events, oldest first.
+// trace dump: Writes "CmdT", the uint32_t event count, and then the raw events.
+// trace clear: Discards the recorded events.
+extern const Cmd_Node_t Cmd_TraceNode;
+#endif
+
+#ifdef CMD_USE_HELP_TEXT
+// Generated by Tools/cmd_help.py, along with the descriptions.
+extern const uint8_t Cmd_HelpDictionary[];
+#endif
+
 /*
  * PUBLIC FUNCTIONS
  */
@@ -167,6 +535,12 @@ typedef struct Cmd_Line_s {
 // The heap is used for holding arguments and lines. It should be approximately 4x the maximum line size.
 void Cmd_Init(Cmd_Line_t * line, const Cmd_Node_t * root, void (*print)(const uint8_t * data, uint32_t size), void * heap, uint32_t heapSize);
 
+// Initialise a line that shares a heap with other lines. The line buffer must be CMD_MAX_LINE long.
+// The heap is only lent to a line while it is working, so lines may share it if they run on the same thread.
+// A shared heap should be approximately 3x the maximum line size.
+void Cmd_InitShared(Cmd_Line_t * line, const Cmd_Node_t * root, void (*print)(const uint8_t * data, uint32_t size), char * bfr, Cmd_Heap_t * heap);
+void Cmd_InitHeap(Cmd_Heap_t * heap, void * data, uint32_t size);
+
 // This starts a new 'session' discarding any previous state
 // The prompt will be re-printed if enabled. This is required to print the prompt first time, as Cmd_Init will not.
 // Calling this before Cmd_Parse is NOT required
@@ -175,14 +549,94 @@ void Cmd_Start(Cmd_Line_t * line);
 // Parses incoming data. This can parse partial or multiple lines.
 void Cmd_Parse(Cmd_Line_t * line, const uint8_t * data, uint32_t count);
 
+// Resolves a command and parses its arguments, so that it can be invoked many times without parsing it again.
+// Any argument data is allocated on the heap, so the binding is only valid until that is freed.
+bool Cmd_Bind(Cmd_Line_t * line, Cmd_Binding_t * binding, const char * str);
+void Cmd_Invoke(Cmd_Line_t * line, Cmd_Binding_t * binding);
+
+// Runs a function node directly from already parsed arguments, bypassing the text parser.
+// The arguments are checked against the node. Optional arguments may be omitted by marking them not present, or by reducing argc.
+bool Cmd_Exec(Cmd_Line_t * line, const Cmd_Node_t * node, const Cmd_ArgValue_t * args, uint32_t argc);
+// As above, but the node is found from its path relative to the root, ie "spi read".
+bool Cmd_ExecPath(Cmd_Line_t * line, const char * path, const Cmd_ArgValue_t * args, uint32_t argc);
+
+#ifdef CMD_USE_MENU_POOLS
+// Adds a node to the pool. This fails if the pool is full, or already holds a node with the same name.
+bool Cmd_Attach(Cmd_MenuPool_t * pool, const Cmd_Node_t * node);
+// Removes a node from the pool. A line part way through typing a command under the node may still run it, so detach between commands.
+bool Cmd_Detach(Cmd_MenuPool_t * pool, const Cmd_Node_t * node);
+#endif
+
+// Redirects all output for this line into the capture buffer, rather than the print function. Output beyond its size is discarded, unless it has a flush function.
+// NULL restores normal output. The previous capture is returned so that captures may be nested.
+Cmd_Capture_t * Cmd_Capture(Cmd_Line_t * line, Cmd_Capture_t * capture);
+
+#ifdef CMD_USE_REPEAT
+// Runs any periodic command that is due. The time may be in any unit, but is typically milliseconds.
+void Cmd_Tick(Cmd_Line_t * line, uint32_t now);
+#endif
+
+#ifdef CMD_USE_SESSION_LOG
+// Starts writing a log of the line to the write function, which may append it to a file or buffer. NULL stops the log.
+// The line config and heap size are written first, so the line should already be set up.
+void Cmd_SessionLog(Cmd_Line_t * line, void (*write)(const uint8_t * data, uint32_t size));
+#endif
+
 // Commands can use these for putting formatted responses back on the command line.
 void Cmd_Print(Cmd_Line_t * line, Cmd_ReplyLevel_t level, const char * data, uint32_t count);
 void Cmd_Prints(Cmd_Line_t * line, Cmd_ReplyLevel_t level, const char * str);
 void Cmd_Printf(Cmd_Line_t * line, Cmd_ReplyLevel_t level, const char * fmt, ...);
 
+#ifdef CMD_USE_NOTIFY
+// These may be used outside of commands, such as for logging. The first message erases the line being typed,
+// and later messages are written below it without another erase. The line is redrawn once by the next
+// Cmd_Tick, Cmd_Parse or Cmd_Redraw, so a burst of messages costs a single erase and redraw.
+// Without CMD_USE_REPEAT, Cmd_Redraw should be called after logging so the line does not stay erased.
+// Messages should end with a line ending. Output from commands run by Cmd_Tick is treated the same way.
+void Cmd_Notify(Cmd_Line_t * line, Cmd_ReplyLevel_t level, const char * str);
+void Cmd_Log(Cmd_Line_t * line, Cmd_ReplyLevel_t level, const char * fmt, ...);
+// Redraws the prompt and line if it was erased by a notification. This flushes any pending redraw.
+void Cmd_Redraw(Cmd_Line_t * line);
+#endif
+
+#ifdef CMD_USE_RECORDS
+// Structured replies, rendered according to cfg.record. Names and keys should be plain identifiers.
+// Binary formats are written without any decimal or hex formatting.
+void Cmd_BeginRecord(Cmd_Line_t * line, const char * name);
+void Cmd_RecordNumber(Cmd_Line_t * line, const char * key, uint32_t value);
+void Cmd_RecordBytes(Cmd_Line_t * line, const char * key, const uint8_t * data, uint32_t size);
+void Cmd_RecordString(Cmd_Line_t * line, const char * key, const char * str);
+void Cmd_EndRecord(Cmd_Line_t * line);
+#endif
+
+#ifdef CMD_USE_REGISTERS
+// Publishes a number, which later commands may use as an argument, ie "spi read $addr".
+// Returns false if the name is too long, or all registers are in use. Registers are cleared by Cmd_Start.
+bool Cmd_SetRegister(Cmd_Line_t * line, const char * name, uint32_t value);
+bool Cmd_GetRegister(Cmd_Line_t * line, const char * name, uint32_t * value);
+#endif
+
+#ifdef CMD_USE_STREAM
+// Compresses binary output written between these. The frame is "CmdZ" and the window size as a byte,
+// then the compressed data, then an end marker and the uint32_t uncompressed size. See Tools/cmd_stream.py for the format.
+void Cmd_BeginStream(Cmd_Line_t * line, Cmd_Stream_t * stream);
+void Cmd_WriteStream(Cmd_Line_t * line, Cmd_Stream_t * stream, const uint8_t * data, uint32_t size);
+void Cmd_EndStream(Cmd_Line_t * line, Cmd_Stream_t * stream);
+#endif
+
+#ifdef CMD_USE_DUMP
+// Writes out the data a row at a time, so that any length may be dumped without using the heap.
+// The address is printed as the offset of the first byte, when dumping rows.
+void Cmd_Dump(Cmd_Line_t * line, Cmd_DumpFormat_t format, const uint8_t * data, uint32_t size, uint32_t address);
+#endif
+
 // Used internally for accessing the command heap. This may be used for commands.
 // Note: this is not a smart heap. Items should be freed in order.
 void * Cmd_Malloc(Cmd_Line_t * line, uint32_t size);
 void Cmd_Free(Cmd_Line_t * line, void * ptr);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif //COMMAND_H
@@ -0,0 +1,353 @@
+#ifndef COMMAND_HPP
+#define COMMAND_HPP
+
+#include "Cmd.h"
+
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+/*
+ * A C++20 front end for building node trees at compile time.
+ * Names are validated, and menus are checked for duplicate names, before anything is linked.
+ * Each menu is emitted with a sorted index, so that its children are binary searched.
+ *
+ * Functions are described by a struct with a name, a Run function, and a name for each argument.
+ * The argument types are taken from the Run parameters:
+ *
+ *	struct Read {
+ *		static constexpr const char * name = "read";
+ *		static constexpr const char * args[] = { "address", "count" };
+ *		static void Run(Cmd_Line_t * line, uint32_t address, std::optional<uint32_t> count);
+ *	};
+ *
+ * Menus are described by a struct with a name, and a list of their nodes:
+ *
+ *	struct Spi {
+ *		static constexpr const char * name = "spi";
+ *		using Nodes = Cmd::List<Read, Write>;
+ *	};
+ *
+ *	Cmd_Init(&line, &Cmd::Node<Root>::value, ...);
+ *
+ * Nodes are constant initialised, so no code runs at startup. Designated initialisers are needed to select
+ * the Cmd_Node_t union member, so this header is C++20. GCC and Clang also accept it in C++17 as an extension,
+ * though -pedantic will warn.
+ */
+
+namespace Cmd {
+
+/*
+ * PUBLIC TYPES
+ */
+
+template <typename ... Nodes>
+struct List {};
+
+#ifdef CMD_USE_BYTE_ARGS
+struct Bytes {
+	const uint8_t * data;
+	uint32_t size;
+};
+#endif
+
+#ifdef CMD_USE_LIST_ARGS
+// A list of numbers, ie "[1 2 3]". T may be uint32_t, uint16_t or uint8_t.
+template <typename T>
+struct Span {
+	const T * data;
+	uint32_t count;
+};
+#endif
+
+/*
+ * PRIVATE DEFINITIONS
+ */
+
+namespace Detail {
+
+constexpr bool IsNameValid(const char * name)
+{
+	if (name == nullptr || *name == 0)
+	{
+		return false;
+	}
+#ifdef CMD_HELP_TOKEN
+	if (std::string_view(name) == CMD_HELP_TOKEN)
+	{
+		return false;
+	}
+#endif
+	for (const char * head = name; *head != 0; head++)
+	{
+		char ch = *head;
+		if (ch <= ' ' || ch > '~' || ch == '"' || ch == '\'' || ch == '[' || ch == '<')
+		{
+			// These would not survive tokenizing
+			return false;
+		}
+	}
+	return true;
+}
+
+template <std::size_t N>
+constexpr std::array<uint8_t, N> SortNames(const std::array<const char *, N> & names)
+{
+	// Insertion sort, yielding the positions of the names in order.
+	std::array<uint8_t, N> index {};
+	for (std::size_t i = 0; i < N; i++)
+	{
+		std::size_t j = i;
+		while (j > 0 && std::string_view(names[index[j - 1]]) > std::string_view(names[i]))
+		{
+			index[j] = index[j - 1];
+			j--;
+		}
+		index[j] = static_cast<uint8_t>(i);
+	}
+	return index;
+}
+
+template <std::size_t N>
+constexpr bool AreNamesUnique(const std::array<const char *, N> & names)
+{
+	std::array<uint8_t, N> index = SortNames(names);
+	for (std::size_t i = 1; i < N; i++)
+	{
+		if (std::string_view(names[index[i - 1]]) == std::string_view(names[index[i]]))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Maps callback parameter types onto argument types.
+template <typename T, typename Enable = void>
+struct Arg;
+
+template <typename T>
+struct Arg<T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>>> {
+	static constexpr uint8_t type = Cmd_Arg_Number;
+	static T Get(const Cmd_ArgValue_t & value) { return static_cast<T>(value.number); }
+};
+
+#ifdef CMD_USE_BOOL_ARGS
+template <>
+struct Arg<bool> {
+	static constexpr uint8_t type = Cmd_Arg_Bool;
+	static bool Get(const Cmd_ArgValue_t & value) { return value.boolean; }
+};
+#endif
+
+#ifdef CMD_USE_BYTE_ARGS
+template <>
+struct Arg<Bytes> {
+	static constexpr uint8_t type = Cmd_Arg_Bytes;
+	static Bytes Get(const Cmd_ArgValue_t & value) { return Bytes { value.bytes.data, value.bytes.size }; }
+};
+#endif
+
+#ifdef CMD_USE_LIST_ARGS
+template <>
+struct Arg<Span<uint32_t>> {
+	static constexpr uint8_t type = Cmd_Arg_List32;
+	static Span<uint32_t> Get(const Cmd_ArgValue_t & value) { return Span<uint32_t> { value.list.u32, value.list.count }; }
+};
+
+template <>
+struct Arg<Span<uint16_t>> {
+	static constexpr uint8_t type = Cmd_Arg_List16;
+	static Span<uint16_t> Get(const Cmd_ArgValue_t & value) { return Span<uint16_t> { value.list.u16, value.list.count }; }
+};
+
+template <>
+struct Arg<Span<uint8_t>> {
+	static constexpr uint8_t type = Cmd_Arg_List8;
+	static Span<uint8_t> Get(const Cmd_ArgValue_t & value) { return Span<uint8_t> { value.list.u8, value.list.count }; }
+};
+#endif
+
+#ifdef CMD_USE_STRING_ARGS
+template <>
+struct Arg<std::string_view> {
+	static constexpr uint8_t type = Cmd_Arg_String;
+	static std::string_view Get(const Cmd_ArgValue_t & value) { return std::string_view(value.str); }
+};
+#endif
+
+template <typename T>
+struct Arg<std::optional<T>> {
+	static constexpr uint8_t type = Arg<T>::type | Cmd_Arg_Optional;
+	static std::optional<T> Get(const Cmd_ArgValue_t & value)
+	{
+		if (value.present)
+		{
+			return Arg<T>::Get(value);
+		}
+		return std::nullopt;
+	}
+};
+
+template <typename F>
+struct Callback;
+
+template <typename ... A>
+struct Callback<void (*)(Cmd_Line_t *, A ...)> {
+	using Args = std::tuple<std::decay_t<A> ...>;
+	static constexpr std::size_t count = sizeof...(A);
+};
+
+template <typename T, typename Enable = void>
+struct IsMenu : std::false_type {};
+
+template <typename T>
+struct IsMenu<T, std::void_t<typename T::Nodes>> : std::true_type {};
+
+template <typename T, typename Enable = void>
+struct ArgNames {
+	static constexpr const char * const * names = nullptr;
+	static constexpr std::size_t count = 0;
+};
+
+template <typename T>
+struct ArgNames<T, std::void_t<decltype(T::args)>> {
+	static constexpr const char * const * names = T::args;
+	static constexpr std::size_t count = std::extent_v<decltype(T::args)>;
+};
+
+#ifdef CMD_USE_HELP_TEXT
+// Nodes may give a description from Tools/cmd_help.py as a static help member.
+template <typename T, typename Enable = void>
+struct Help {
+	static constexpr const uint8_t * value = nullptr;
+};
+
+template <typename T>
+struct Help<T, std::void_t<decltype(T::help)>> {
+	static constexpr const uint8_t * value = T::help;
+};
+#endif
+
+// Any members enabled by other features, such as choices or help, are left empty.
+constexpr Cmd_Arg_t MakeArg(const char * name, uint8_t type)
+{
+	Cmd_Arg_t arg {};
+	arg.name = name;
+	arg.type = type;
+	return arg;
+}
+
+template <typename T, bool Menu = IsMenu<T>::value>
+struct Node;
+
+template <typename T>
+struct Node<T, false> {
+	using Signature = Callback<decltype(&T::Run)>;
+	using Args = typename Signature::Args;
+	static constexpr std::size_t count = Signature::count;
+
+	static_assert(IsNameValid(T::name), "Function names must not be empty, or contain whitespace or delimiters");
+	static_assert(ArgNames<T>::count == count, "Each parameter of Run must be given a name in args");
+
+	template <std::size_t ... I>
+	static constexpr std::array<Cmd_Arg_t, count> MakeArgs(std::index_sequence<I ...>)
+	{
+		return {{ MakeArg(ArgNames<T>::names[I], Arg<std::tuple_element_t<I, Args>>::type) ... }};
+	}
+
+	static constexpr std::array<Cmd_Arg_t, count> args = MakeArgs(std::make_index_sequence<count>());
+
+	static constexpr bool AreOptionalsLast()
+	{
+		bool optional = false;
+		for (const Cmd_Arg_t & arg : args)
+		{
+			if (optional && !(arg.type & Cmd_Arg_Optional))
+			{
+				return false;
+			}
+			optional = arg.type & Cmd_Arg_Optional;
+		}
+		return true;
+	}
+	static_assert(AreOptionalsLast(), "Optional arguments must follow all required arguments");
+
+	template <std::size_t ... I>
+	static void Invoke(Cmd_Line_t * line, Cmd_ArgValue_t * argv, std::index_sequence<I ...>)
+	{
+		T::Run(line, Arg<std::tuple_element_t<I, Args>>::Get(argv[I]) ...);
+	}
+
+	static void Run(Cmd_Line_t * line, Cmd_ArgValue_t * argv)
+	{
+		Invoke(line, argv, std::make_index_sequence<count>());
+	}
+
+	static constexpr Cmd_Node_t value = {
+		.name = T::name,
+		.type = Cmd_Node_Function,
+#ifdef CMD_USE_HELP_TEXT
+		.help = Help<T>::value,
+#endif
+		.func = {
+			.args = count ? args.data() : nullptr,
+			.arglen = count,
+			.callback = Run,
+		},
+	};
+};
+
+template <typename T, typename L = typename T::Nodes>
+struct Menu;
+
+template <typename T, typename ... C>
+struct Menu<T, List<C ...>> {
+	static constexpr std::size_t count = sizeof...(C);
+
+	static_assert(IsNameValid(T::name), "Menu names must not be empty, or contain whitespace or delimiters");
+	static_assert(count > 0, "Menus must contain at least one node");
+	static_assert(count <= 256, "Menus may contain at most 256 nodes");
+
+	static constexpr std::array<const char *, count> names = {{ C::name ... }};
+	static_assert(AreNamesUnique(names), "Menus must not contain duplicate names");
+
+	static constexpr const Cmd_Node_t * nodes[] = { &Node<C>::value ... };
+	static constexpr std::array<uint8_t, count> index = SortNames(names);
+};
+
+template <typename T>
+struct Node<T, true> {
+	using Items = Menu<T>;
+
+	static constexpr Cmd_Node_t value = {
+		.name = T::name,
+		.type = Cmd_Node_Menu,
+#ifdef CMD_USE_HELP_TEXT
+		.help = Help<T>::value,
+#endif
+		.menu = {
+			.nodes = Items::nodes,
+			.count = Items::count,
+			.index = Items::index.data(),
+		},
+	};
+};
+
+} // namespace Detail
+
+/*
+ * PUBLIC DEFINITIONS
+ */
+
+// The Cmd_Node_t for a function or menu is Cmd::Node<T>::value
+template <typename T>
+using Node = Detail::Node<T>;
+
+} // namespace Cmd
+
+#endif //COMMAND_HPP
@@ -0,0 +1,168 @@
+
+#include "CmdMux.h"
+#include <stddef.h>
+
+/*
+ * PRIVATE DEFINITIONS
+ */
+
+#define CMD_MUX_NONE		0xFF
+
+/*
+ * PRIVATE TYPES
+ */
+
+/*
+ * PRIVATE PROTOTYPES
+ */
+
+static void Cmd_MuxDeliver(Cmd_Mux_t * mux, const uint8_t * data, uint32_t count);
+static void Cmd_MuxSend(Cmd_Mux_t * mux, Cmd_MuxChannel_t * channel);
+static void Cmd_MuxFlushChannel(Cmd_Capture_t * capture);
+
+/*
+ * PRIVATE VARIABLES
+ */
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+bool Cmd_MuxInit(Cmd_Mux_t * mux, Cmd_MuxChannel_t * channels, uint32_t count, void (*write)(const uint8_t * data, uint32_t size))
+{
+	// Larger ids could not be told apart from an escaped escape byte, and would not fit in the count.
+	bool valid = count <= CMD_MUX_MAX_CHANNELS;
+	mux->write = write;
+	mux->channels = channels;
+	mux->count = valid ? count : 0;
+	mux->rx = 0;
+	mux->tx = CMD_MUX_NONE;
+	mux->next = 0;
+	mux->escaped = false;
+	for (uint32_t i = 0; i < mux->count; i++)
+	{
+		channels[i].line = NULL;
+		channels[i].mux = mux;
+	}
+	return valid;
+}
+
+bool Cmd_MuxAttach(Cmd_Mux_t * mux, uint32_t id, Cmd_Line_t * line, uint8_t * bfr, uint32_t size)
+{
+	if (id >= mux->count)
+	{
+		return false;
+	}
+	Cmd_MuxChannel_t * channel = &mux->channels[id];
+	channel->line = line;
+	channel->capture.data = bfr;
+	channel->capture.size = size;
+	channel->capture.count = 0;
+	channel->capture.flush = Cmd_MuxFlushChannel;
+	Cmd_Capture(line, &channel->capture);
+	return true;
+}
+
+void Cmd_MuxParse(Cmd_Mux_t * mux, const uint8_t * data, uint32_t count)
+{
+	// Unescaped runs are passed on to the line whole.
+	const uint8_t * run = data;
+	while (count--)
+	{
+		uint8_t ch = *data++;
+		if (mux->escaped)
+		{
+			mux->escaped = false;
+			if (ch == CMD_MUX_ESC)
+			{
+				// A literal escape byte begins the next run.
+				run = data - 1;
+			}
+			else
+			{
+				mux->rx = ch;
+				run = data;
+			}
+		}
+		else if (ch == CMD_MUX_ESC)
+		{
+			Cmd_MuxDeliver(mux, run, (data - run) - 1);
+			mux->escaped = true;
+		}
+	}
+	if (!mux->escaped)
+	{
+		Cmd_MuxDeliver(mux, run, data - run);
+	}
+	Cmd_MuxFlush(mux);
+}
+
+void Cmd_MuxFlush(Cmd_Mux_t * mux)
+{
+	uint32_t first = mux->next;
+	for (uint32_t i = 0; i < mux->count; i++)
+	{
+		uint32_t id = (first + i) % mux->count;
+		Cmd_MuxChannel_t * channel = &mux->channels[id];
+		if (channel->line != NULL && channel->capture.count)
+		{
+			Cmd_MuxSend(mux, channel);
+			mux->next = (id + 1) % mux->count;
+		}
+	}
+}
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static void Cmd_MuxDeliver(Cmd_Mux_t * mux, const uint8_t * data, uint32_t count)
+{
+	// Input for unknown or unattached channels is dropped.
+	if (count && mux->rx < mux->count)
+	{
+		Cmd_MuxChannel_t * channel = &mux->channels[mux->rx];
+		if (channel->line != NULL)
+		{
+			Cmd_Parse(channel->line, data, count);
+		}
+	}
+}
+
+static void Cmd_MuxSend(Cmd_Mux_t * mux, Cmd_MuxChannel_t * channel)
+{
+	uint8_t id = channel - mux->channels;
+	if (mux->tx != id)
+	{
+		uint8_t header[] = { CMD_MUX_ESC, id };
+		mux->write(header, sizeof(header));
+		mux->tx = id;
+	}
+
+	const uint8_t * data = channel->capture.data;
+	const uint8_t * end = data + channel->capture.count;
+	const uint8_t * run = data;
+	while (data < end)
+	{
+		if (*data++ == CMD_MUX_ESC)
+		{
+			// Write the run including the escape byte, and then the escape byte again.
+			mux->write(run, data - run);
+			run = data - 1;
+		}
+	}
+	mux->write(run, data - run);
+	channel->capture.count = 0;
+}
+
+static void Cmd_MuxFlushChannel(Cmd_Capture_t * capture)
+{
+	// A channel that fills its buffer is sent immediately, rather than waiting its turn.
+	Cmd_MuxChannel_t * channel = (Cmd_MuxChannel_t *)capture;
+	Cmd_MuxSend(channel->mux, channel);
+}
+
+/*
+ * INTERRUPT ROUTINES
+ */
+
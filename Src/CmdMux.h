@@ -0,0 +1,65 @@
+#ifndef COMMAND_MUX_H
+#define COMMAND_MUX_H
+
+#include "Cmd.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * PUBLIC DEFINITIONS
+ */
+
+// Frames are switched by the escape byte followed by the channel id. An escaped escape byte is a literal.
+// ie, "\x10\x01hello" is 'hello' on channel 1, and "\x10\x10" is a literal 0x10.
+#define CMD_MUX_ESC			0x10
+#define CMD_MUX_MAX_CHANNELS	CMD_MUX_ESC
+
+/*
+ * PUBLIC TYPES
+ */
+
+typedef struct Cmd_Mux_s Cmd_Mux_t;
+
+typedef struct {
+	Cmd_Capture_t capture; // Must be first
+	Cmd_Line_t * line;
+	Cmd_Mux_t * mux;
+} Cmd_MuxChannel_t;
+
+typedef struct Cmd_Mux_s {
+	void (*write)(const uint8_t * data, uint32_t size);
+	Cmd_MuxChannel_t * channels;
+	uint8_t count;
+	uint8_t rx;		// The channel receiving input
+	uint8_t tx;		// The channel last selected on the output
+	uint8_t next;	// The channel to be flushed first
+	bool escaped;
+} Cmd_Mux_t;
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+// Shares a single link between many lines. The write function sends framed data on the link.
+// There may be up to CMD_MUX_MAX_CHANNELS channels. Returns false if there are more, and the mux is left with none.
+bool Cmd_MuxInit(Cmd_Mux_t * mux, Cmd_MuxChannel_t * channels, uint32_t count, void (*write)(const uint8_t * data, uint32_t size));
+
+// Attaches a line to a channel. Its output is held in the buffer until the mux is flushed, or the buffer is full.
+// The line should already be initialised. Its print function will not be used.
+// Returns false if the channel id is not within the count given to Cmd_MuxInit.
+bool Cmd_MuxAttach(Cmd_Mux_t * mux, uint32_t id, Cmd_Line_t * line, uint8_t * bfr, uint32_t size);
+
+// Parses framed data from the link, passing it on to the lines. Any resulting output is flushed.
+void Cmd_MuxParse(Cmd_Mux_t * mux, const uint8_t * data, uint32_t count);
+
+// Writes out any buffered output. The channels are taken in turn, so that no channel is favoured.
+// This should be called after printing to the lines from outside of Cmd_MuxParse, such as by Cmd_Log.
+void Cmd_MuxFlush(Cmd_Mux_t * mux);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //COMMAND_MUX_H
@@ -1,12 +1,23 @@
 
 #include "CmdParse.h"
-#include <stdio.h>
 #include <string.h>
 
 /*
  * PRIVATE DEFINITIONS
  */
 
+// Byte literals are needed for bytes arguments, and for escape sequences in strings.
+#if defined(CMD_USE_BYTE_ARGS) || (defined(CMD_USE_STRING_ARGS) && defined(CMD_USE_STRING_ESC))
+#define CMD_PARSE_BYTE
+#endif
+
+#ifdef CMD_USE_NUMBER_ENG
+#define CMD_PARSE_LOWCHAR
+#endif
+
+#define CMD_CHAR(_cls, _value)			{ (_cls), (_value) }
+#define CMD_CHAR_HEX(_cls, _n, _esc)	{ Cmd_Char_Hex | (_cls), ((_esc) << 4) | (_n) }
+
 /*
  * PRIVATE TYPES
  */
@@ -15,13 +26,14 @@
  * PRIVATE PROTOTYPES
  */
 
+#ifdef CMD_PARSE_LOWCHAR
 static char Cmd_Lowchar(char ch);
+#endif
 #ifdef CMD_USE_NUMBER_HEX
 static bool Cmd_ParseHexPrefix(const char ** str);
 static bool Cmd_ParseHex(const char ** str, uint32_t * value);
 #endif
-static bool Cmd_ParseNibble(char ch, uint32_t * n);
-#ifdef CMD_USE_BYTE_ARGS
+#ifdef CMD_PARSE_BYTE
 static bool Cmd_ParseByte(const char ** str, uint8_t * value);
 #endif
 static bool Cmd_ParseUint(const char ** str, uint32_t * value);
@@ -33,10 +45,62 @@ static bool Cmd_ParseFixedUint(const char ** str, uint32_t length, uint32_t * va
  * PRIVATE VARIABLES
  */
 
-#ifdef CMD_USE_STRING_ESC
+#if defined(CMD_USE_STRING_ARGS) && defined(CMD_USE_STRING_ESC)
+// The escapes for '\a' to '\r', when formatting.
 static const char gEscCharmap[] = "abtnvfr";
 #endif
 
+#if defined(CMD_USE_BYTE_ARGS) || (defined(CMD_USE_STRING_ARGS) && defined(CMD_USE_STRING_ESC))
+static const char gHexChars[] = "0123456789ABCDEF";
+#endif
+
+/*
+ * PUBLIC VARIABLES
+ */
+
+// Chars not listed have no class.
+const Cmd_CharInfo_t Cmd_CharTable[256] = {
+	[0]		= CMD_CHAR(Cmd_Char_End | Cmd_Char_Stop, 0),
+	['\t']	= CMD_CHAR(Cmd_Char_Space, 0),
+	[' ']	= CMD_CHAR(Cmd_Char_Space | Cmd_Char_Separator, 0),
+	['"']	= CMD_CHAR(Cmd_Char_Quote | Cmd_Char_Stop, '"'),
+	['\'']	= CMD_CHAR(Cmd_Char_Quote | Cmd_Char_Stop, '\''),
+	['[']	= CMD_CHAR(Cmd_Char_Quote, ']'),
+	[']']	= CMD_CHAR(Cmd_Char_Stop, 0),
+	['<']	= CMD_CHAR(Cmd_Char_Quote, '>'),
+	['>']	= CMD_CHAR(Cmd_Char_Stop, 0),
+	['\\']	= CMD_CHAR(Cmd_Char_Stop, 0),
+	[',']	= CMD_CHAR(Cmd_Char_Separator, 0),
+	['-']	= CMD_CHAR(Cmd_Char_Separator, 0),
+	[':']	= CMD_CHAR(Cmd_Char_Separator, 0),
+	['0']	= CMD_CHAR_HEX(Cmd_Char_Digit | Cmd_Char_Escape, 0, 0),
+	['1']	= CMD_CHAR_HEX(Cmd_Char_Digit, 1, 0),
+	['2']	= CMD_CHAR_HEX(Cmd_Char_Digit, 2, 0),
+	['3']	= CMD_CHAR_HEX(Cmd_Char_Digit, 3, 0),
+	['4']	= CMD_CHAR_HEX(Cmd_Char_Digit, 4, 0),
+	['5']	= CMD_CHAR_HEX(Cmd_Char_Digit, 5, 0),
+	['6']	= CMD_CHAR_HEX(Cmd_Char_Digit, 6, 0),
+	['7']	= CMD_CHAR_HEX(Cmd_Char_Digit, 7, 0),
+	['8']	= CMD_CHAR_HEX(Cmd_Char_Digit, 8, 0),
+	['9']	= CMD_CHAR_HEX(Cmd_Char_Digit, 9, 0),
+	['A']	= CMD_CHAR_HEX(0, 10, 0),
+	['B']	= CMD_CHAR_HEX(0, 11, 0),
+	['C']	= CMD_CHAR_HEX(0, 12, 0),
+	['D']	= CMD_CHAR_HEX(0, 13, 0),
+	['E']	= CMD_CHAR_HEX(0, 14, 0),
+	['F']	= CMD_CHAR_HEX(0, 15, 0),
+	['a']	= CMD_CHAR_HEX(Cmd_Char_Escape, 10, '\a'),
+	['b']	= CMD_CHAR_HEX(Cmd_Char_Escape, 11, '\b'),
+	['c']	= CMD_CHAR_HEX(0, 12, 0),
+	['d']	= CMD_CHAR_HEX(0, 13, 0),
+	['e']	= CMD_CHAR_HEX(0, 14, 0),
+	['f']	= CMD_CHAR_HEX(Cmd_Char_Escape, 15, '\f'),
+	['n']	= CMD_CHAR(Cmd_Char_Escape, '\n' << 4),
+	['r']	= CMD_CHAR(Cmd_Char_Escape, '\r' << 4),
+	['t']	= CMD_CHAR(Cmd_Char_Escape, '\t' << 4),
+	['v']	= CMD_CHAR(Cmd_Char_Escape, '\v' << 4),
+};
+
 /*
  * PUBLIC FUNCTIONS
  */
@@ -99,8 +163,7 @@ bool Cmd_ParseBytes(const char ** str, uint8_t * value, uint32_t size, uint32_t
 		{
 			break;
 		}
-		char next = **str;
-		if (next == '-' || next == ':' || next == ',' || next == ' ')
+		if (CMD_CHAR_CLASS(**str) & Cmd_Char_Separator)
 		{
 			// Bytes may use these as delimiters.
 			(*str)++;
@@ -115,7 +178,8 @@ uint32_t Cmd_FormatBytes(char * dst, uint8_t * hex, uint32_t count, char space)
 	char * start = dst;
 	while(count--)
 	{
-		dst += sprintf(dst, "%02X", *hex++);
+		*dst++ = gHexChars[*hex >> 4];
+		*dst++ = gHexChars[*hex++ & 0xF];
 		if (space != 0 && count)
 		{
 			*dst++ = space;
@@ -126,63 +190,98 @@ uint32_t Cmd_FormatBytes(char * dst, uint8_t * hex, uint32_t count, char space)
 }
 #endif //CMD_USE_BYTE_ARGS
 
+#ifdef CMD_USE_LIST_ARGS
+bool Cmd_ParseList(const char ** str, void * value, uint32_t width, uint32_t size, uint32_t * count)
+{
+	uint32_t n = 0;
+	const char * head = *str;
+	while (1)
+	{
+		// Numbers may be separated by whitespace or commas.
+		while ((CMD_CHAR_CLASS(*head) & Cmd_Char_Space) || *head == ',')
+		{
+			head++;
+		}
+		if (*head == 0)
+		{
+			break;
+		}
+
+		uint32_t number;
+		if (n >= size || !Cmd_ParseNumber(&head, &number))
+		{
+			return false;
+		}
+		if (!(CMD_CHAR_CLASS(*head) & (Cmd_Char_Space | Cmd_Char_End)) && *head != ',')
+		{
+			// Numbers must not run into each other, ie "0x10x2".
+			return false;
+		}
+		if (width < sizeof(uint32_t) && (number >> (width * 8)))
+		{
+			return false;
+		}
+
+		switch (width)
+		{
+		case sizeof(uint8_t):
+			((uint8_t *)value)[n] = number;
+			break;
+		case sizeof(uint16_t):
+			((uint16_t *)value)[n] = number;
+			break;
+		default:
+			((uint32_t *)value)[n] = number;
+			break;
+		}
+		n++;
+	}
+	*str = head;
+	*count = n;
+	return true;
+}
+#endif //CMD_USE_LIST_ARGS
+
 #ifdef CMD_USE_STRING_ARGS
 #ifdef CMD_USE_STRING_ESC
 bool Cmd_ParseString(const char ** str, char * value, uint32_t size, uint32_t * count)
 {
-	bool escaped = false;
 	uint32_t written;
 	const char * head = *str;
-	for (written = 0; written < size - 1;)
+	for (written = 0; written < size - 1; written++)
 	{
 		char ch = *head++;
-		if (ch == 0)
-		{
-			head--;
-			break;
-		}
-		else if (escaped)
+		if (CMD_CHAR_CLASS(ch) & Cmd_Char_Stop)
 		{
-			bool esc_found = false;
-			for (uint32_t i = 0; i < sizeof(gEscCharmap); i++)
+			// Only the null char and backslash are special here. Quotes are taken as literals.
+			if (ch == '\\')
 			{
-				if (ch == gEscCharmap[i])
+				ch = *head++;
+				if (ch == 0)
 				{
-					ch = '\a' + i;
-					esc_found = true;
+					head--;
 					break;
 				}
-			}
-			if (!esc_found)
-			{
-				// We did not match onto the esc table
-				if (ch == 'x')
+				else if (CMD_CHAR_CLASS(ch) & Cmd_Char_Escape)
+				{
+					ch = CMD_CHAR_ESCAPE(ch);
+				}
+				else if (ch == 'x')
 				{
 					if (!Cmd_ParseByte(&head, (uint8_t*)&ch))
 					{
 						return false;
 					}
 				}
-				else if (ch == '0')
-				{
-					ch = 0;
-				}
-				// Otherwise we just interpret it as literal.
-				// Other chars (', ", \, ?) can get their literal interpretation.
+				// Other chars (', ", \, ?) get their literal interpretation.
+			}
+			else if (ch == 0)
+			{
+				head--;
+				break;
 			}
-			escaped = false;
-			*value++ = ch;
-			written++;
-		}
-		else if (ch == '\\')
-		{
-			escaped = true;
-		}
-		else
-		{
-			*value++ = ch;
-			written++;
 		}
+		*value++ = ch;
 	}
 	*value = 0; // Enforce null char.
 	*str = head;
@@ -224,7 +323,10 @@ uint32_t Cmd_FormatString(char * dst, uint32_t size, uint8_t * data, uint32_t co
 			{
 				break;
 			}
-			dst += sprintf(dst, "\\x%02X", ch);
+			*dst++ = '\\';
+			*dst++ = 'x';
+			*dst++ = gHexChars[(uint8_t)ch >> 4];
+			*dst++ = gHexChars[ch & 0xF];
 		}
 	}
 	*dst = 0;
@@ -246,6 +348,9 @@ bool Cmd_ParseString(const char ** str, char * value, uint32_t size, uint32_t *
 
 uint32_t Cmd_FormatString(char * dst, uint32_t size, uint8_t * data, uint32_t count, char delimiter)
 {
+	// Without escapes, the string is copied up to its null char.
+	(void)count;
+	(void)delimiter;
 	const char * head = (char*)data;
 	while (size-- && *head != 0)
 	{
@@ -261,6 +366,7 @@ uint32_t Cmd_FormatString(char * dst, uint32_t size, uint8_t * data, uint32_t co
  * PRIVATE FUNCTIONS
  */
 
+#ifdef CMD_PARSE_LOWCHAR
 static char Cmd_Lowchar(char ch)
 {
 	if (ch >= 'A' && ch <= 'Z')
@@ -269,6 +375,7 @@ static char Cmd_Lowchar(char ch)
 	}
 	return ch;
 }
+#endif
 
 #ifdef CMD_USE_NUMBER_HEX
 static bool Cmd_ParseHexPrefix(const char ** str)
@@ -279,7 +386,7 @@ static bool Cmd_ParseHexPrefix(const char ** str)
 		// We want to allow 0x or 0h prefix.
 		start += 1;
 	}
-	char pfx = Cmd_Lowchar(*start);
+	char pfx = *start | ('a' - 'A');
 	if (pfx == 'x' || pfx == 'h')
 	{
 		*str = start+1;
@@ -292,15 +399,9 @@ static bool Cmd_ParseHex(const char ** str, uint32_t * value)
 {
 	uint32_t v = 0;
 	const char * head = *str;
-	while (1)
+	while (CMD_CHAR_CLASS(*head) & Cmd_Char_Hex)
 	{
-		uint32_t d;
-		if (!Cmd_ParseNibble(*head, &d))
-		{
-			break;
-		}
-		head++;
-		v = (v << 4) | d;
+		v = (v << 4) | CMD_CHAR_NIBBLE(*head++);
 	}
 	if (head > *str)
 	{
@@ -313,33 +414,15 @@ static bool Cmd_ParseHex(const char ** str, uint32_t * value)
 }
 #endif //CMD_USE_NUMBER_HEX
 
-static bool Cmd_ParseNibble(char ch, uint32_t * n)
-{
-	ch = Cmd_Lowchar(ch);
-	if (ch >= '0' && ch <= '9')
-	{
-		*n = ch - '0';
-		return true;
-	}
-	else if (ch >= 'a' && ch <= 'f')
-	{
-		*n = ch - ('a' - 10);
-		return true;
-	}
-	return false;
-}
-
-#ifdef CMD_USE_BYTE_ARGS
+#ifdef CMD_PARSE_BYTE
 static bool Cmd_ParseByte(const char ** str, uint8_t * value)
 {
 	const char * head = *str;
-
-	uint32_t high;
-	uint32_t low;
-	if (Cmd_ParseNibble(*head++, &high) && Cmd_ParseNibble(*head++, &low))
+	// The second char is only read if the first is not the null terminator.
+	if ((CMD_CHAR_CLASS(head[0]) & Cmd_Char_Hex) && (CMD_CHAR_CLASS(head[1]) & Cmd_Char_Hex))
 	{
-		*str = head;
-		*value = (high << 4) | low;
+		*str = head + 2;
+		*value = (CMD_CHAR_NIBBLE(head[0]) << 4) | CMD_CHAR_NIBBLE(head[1]);
 		return true;
 	}
 	return false;
@@ -350,18 +433,9 @@ static bool Cmd_ParseUint(const char ** str, uint32_t * value)
 {
 	uint32_t v = 0;
 	const char * head = *str;
-	while (1)
+	while (CMD_CHAR_CLASS(*head) & Cmd_Char_Digit)
 	{
-		char ch = *head;
-		if (ch >= '0' && ch <= '9')
-		{
-			v = (v * 10) + (ch - '0');
-			head++;
-		}
-		else
-		{
-			break;
-		}
+		v = (v * 10) + CMD_CHAR_NIBBLE(*head++);
 	}
 	if (head > *str)
 	{
@@ -10,10 +10,38 @@
  * PUBLIC DEFINITIONS
  */
 
+#define CMD_CHAR_CLASS(_ch)		(Cmd_CharTable[(uint8_t)(_ch)].cls)
+#define CMD_CHAR_NIBBLE(_ch)	(Cmd_CharTable[(uint8_t)(_ch)].value & 0x0F)
+#define CMD_CHAR_ESCAPE(_ch)	(Cmd_CharTable[(uint8_t)(_ch)].value >> 4)
+#define CMD_CHAR_CLOSE(_ch)		(Cmd_CharTable[(uint8_t)(_ch)].value)
+
 /*
  * PUBLIC TYPES
  */
 
+typedef enum {
+	Cmd_Char_Space		= (1 << 0), // Separates tokens
+	Cmd_Char_End		= (1 << 1), // The null char
+	Cmd_Char_Quote		= (1 << 2), // Opens a quoted token. The value is the closing char.
+	Cmd_Char_Stop		= (1 << 3), // Ends a run of plain chars within a quoted token
+	Cmd_Char_Digit		= (1 << 4),
+	Cmd_Char_Hex		= (1 << 5), // The low bits of the value are the nibble
+	Cmd_Char_Escape		= (1 << 6), // Follows a backslash. The high bits of the value are the decoded char.
+	Cmd_Char_Separator	= (1 << 7), // May separate bytes
+} Cmd_CharClass_t;
+
+typedef struct {
+	uint8_t cls;
+	uint8_t value;
+} Cmd_CharInfo_t;
+
+/*
+ * PUBLIC VARIABLES
+ */
+
+// Indexed by any char, so that the lexers need only one lookup per char.
+extern const Cmd_CharInfo_t Cmd_CharTable[256];
+
 /*
  * PUBLIC FUNCTIONS
  */
@@ -30,4 +58,9 @@ bool Cmd_ParseBytes(const char ** str, uint8_t * value, uint32_t size, uint32_t
 uint32_t Cmd_FormatBytes(char * dst, uint8_t * data, uint32_t count, char space);
 #endif
 
+#ifdef CMD_USE_LIST_ARGS
+// The width is the size of each value in bytes. Values that do not fit are rejected.
+bool Cmd_ParseList(const char ** str, void * value, uint32_t width, uint32_t size, uint32_t * count);
+#endif
+
 #endif //COMMAND_PARSE_H
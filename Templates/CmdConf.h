@@ -7,7 +7,8 @@
  * BUFFER CONFIGURATION
  */
 
-// Maximum number of arguments to parse.
+// Maximum number of arguments of a command bound by Cmd_Bind, such as by repeat and every.
+// Other commands have their arguments allocated on the heap, and are not limited.
 #define CMD_MAX_ARGS	4
 
 // Maximum line length
@@ -29,6 +30,11 @@
 // This token will produce info on the specified menu or or function
 #define CMD_HELP_TOKEN		"?"
 
+// Allows nodes and arguments to carry descriptions, which are printed with their help.
+// These are compressed by Tools/cmd_help.py, which also generates the Cmd_HelpDictionary they share.
+// This requires CMD_HELP_TOKEN
+//#define CMD_USE_HELP_TEXT
+
 
 /*
  * TERMINAL OUTPUT CONFIGURATION
@@ -51,6 +57,26 @@
 // The line ending sequence on internally generated replies.
 #define CMD_LINE_END	"\r\n"
 
+// Allows Cmd_Notify and Cmd_Log to print asynchronously, by erasing and redrawing the line being typed.
+// The line is erased with an ANSI sequence. Without CMD_USE_ANSI, the message starts on a new line instead.
+//#define CMD_USE_NOTIFY
+
+// Use vsnprintf for Cmd_Printf rather than the built in formatter.
+// This supports every printf conversion, but costs much more flash and stack.
+//#define CMD_USE_VSNPRINTF
+
+// Provides Cmd_BeginRecord and friends, for structured replies.
+// These may be rendered as text, JSON lines or CBOR, as selected by the line config.
+//#define CMD_USE_RECORDS
+
+// Provides Cmd_Dump, which streams memory of any length as hex and ASCII rows, raw hex, or Base64.
+//#define CMD_USE_DUMP
+
+// Provides Cmd_BeginStream and friends, which LZ compress bulk binary output for Tools/cmd_stream.py to expand.
+// Matches are found within the last CMD_STREAM_WINDOW bytes, which must be a power of two of at most 256.
+//#define CMD_USE_STREAM
+#define CMD_STREAM_WINDOW	256
+
 
 /*
  * ARGUMENT CONFIGURATION
@@ -66,6 +92,26 @@
 // Supports bytes as an argument input type
 #define CMD_USE_BYTE_ARGS
 
+// Allows bytes arguments to be decoded directly into a provided buffer, such as a DMA buffer.
+// This requires CMD_USE_BYTE_ARGS
+//#define CMD_USE_BYTE_SINKS
+
+// Supports lists of numbers, ie "[1 0x20 9k6]", packed into arrays of 32, 16 or 8 bit values.
+//#define CMD_USE_LIST_ARGS
+
+// Supports a choice of names as an argument, ie "spi mode fast", which is passed to the callback as the index of the name.
+//#define CMD_USE_CHOICE_ARGS
+
+// Allows the last argument of a function to be repeated, ie "sum 1 2 3 4 5", by flagging it with Cmd_Arg_Variadic.
+// The values are counted and parsed onto the heap, and passed to the callback as an array.
+//#define CMD_USE_VARIADIC_ARGS
+
+// Allows callbacks to publish numbers into named registers, using Cmd_SetRegister.
+// A later number or bool argument may then be given as the register name, ie "$addr".
+//#define CMD_USE_REGISTERS
+#define CMD_REGISTER_COUNT	4
+#define CMD_REGISTER_NAME	8	// Including the null char
+
 // Support backslash escape sequences for string parsing and formatting
 // This supports byte literals "\x00", delimiters "\"", and control chars "\a\r\n\0"
 #define CMD_USE_STRING_ESC
@@ -77,6 +123,40 @@
 #define CMD_USE_NUMBER_ENG
 
 
+/*
+ * MENU CONFIGURATION
+ */
+
+// Provides Cmd_MenuPool_t, a menu which nodes may be attached to and detached from at run time.
+//#define CMD_USE_MENU_POOLS
+
+
+/*
+ * BUILT IN COMMANDS
+ * 		These may be added to your menus
+ */
+
+// Provides Cmd_RepeatNode and Cmd_EveryNode, which run a command many times without re-parsing it.
+// Periodic commands require Cmd_Tick to be called. This requires CMD_USE_STRING_ARGS.
+//#define CMD_USE_REPEAT
+
+
+/*
+ * DIAGNOSTICS
+ */
+
+// Records parse and dispatch events into a ring in RAM, which may be read out using Cmd_TraceNode.
+// CMD_TRACE_TIME() should return a timestamp, such as a millisecond tick. CMD_TRACE_SIZE must be a power of two.
+//#define CMD_USE_TRACE
+#define CMD_TRACE_SIZE		64
+#define CMD_TRACE_TIME()	0
+
+// Allows the input, output and ticks of a line to be recorded with Cmd_SessionLog, for replay by Tools/cmd_replay.c.
+// CMD_SESSION_TIME() should return a timestamp in microseconds.
+//#define CMD_USE_SESSION_LOG
+#define CMD_SESSION_TIME()	0
+
+
 
 
 #endif //COMMAND_CONF_H
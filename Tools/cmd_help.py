@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+"""
+Compresses help descriptions for CMD_USE_HELP_TEXT.
+
+The input has a symbol and its description on each line. Blank lines and lines starting with '#' are ignored.
+
+    spi_read_help: Reads a number of bytes from the bus
+    spi_read_address_help: The register address to read from
+
+    python3 cmd_help.py help.txt --source help.c --header help.h
+
+The output defines each symbol as a compressed description, and Cmd_HelpDictionary which they share.
+They are attached to nodes and arguments with the CMD_*_HELP macros in Cmd.h.
+
+Descriptions are printable ASCII. Each byte of a compressed description is either a literal char,
+or a reference to a dictionary entry when the top bit is set. Each dictionary entry is terminated
+by setting the top bit of its last char. The dictionary holds at most 128 entries.
+"""
+
+import argparse
+import re
+import sys
+
+MAX_ENTRIES = 128
+MAX_WORDS = 4
+CODE_BASE = 0xE000  # Dictionary references are held as private use chars while compressing.
+SYMBOL = re.compile(r"^[A-Za-z_]\w*$")
+
+
+def load(path):
+    descriptions = []
+    with open(path) as f:
+        for number, row in enumerate(f, 1):
+            row = row.rstrip("\r\n")
+            if not row.strip() or row.lstrip().startswith("#"):
+                continue
+            symbol, sep, text = row.partition(":")
+            symbol = symbol.strip()
+            text = text.strip()
+            if not sep or not SYMBOL.match(symbol):
+                raise ValueError("{}:{}: expected 'symbol: description'".format(path, number))
+            if not text or any(not (" " <= ch <= "~") for ch in text):
+                raise ValueError("{}:{}: descriptions must be printable ASCII".format(path, number))
+            descriptions.append((symbol, text))
+    return descriptions
+
+
+def candidates(texts):
+    # Runs of up to MAX_WORDS whole words, with or without a trailing space.
+    # Text that has already been replaced by a dictionary reference is not split.
+    phrases = set()
+    for text in texts:
+        for segment in re.split("[{}-{}]".format(chr(CODE_BASE), chr(CODE_BASE + MAX_ENTRIES - 1)), text):
+            words = segment.split(" ")
+            for i in range(len(words)):
+                for n in range(1, min(MAX_WORDS, len(words) - i) + 1):
+                    phrase = " ".join(words[i:i + n])
+                    phrases.add(phrase)
+                    if i + n < len(words):
+                        phrases.add(phrase + " ")
+    return [phrase for phrase in phrases if len(phrase) > 1]
+
+
+def build(texts):
+    # Greedily take the phrase that saves the most, until the dictionary is full or nothing is saved.
+    entries = []
+    while len(entries) < MAX_ENTRIES:
+        joined = "\n".join(texts)
+        best = None
+        best_saving = 0
+        for phrase in sorted(candidates(texts)):
+            saving = joined.count(phrase) * (len(phrase) - 1) - len(phrase)
+            if saving > best_saving:
+                best, best_saving = phrase, saving
+        if best is None:
+            break
+        code = chr(CODE_BASE + len(entries))
+        texts = [text.replace(best, code) for text in texts]
+        entries.append(best)
+    return entries, texts
+
+
+def encode(text):
+    return [0x80 + ord(ch) - CODE_BASE if ord(ch) >= CODE_BASE else ord(ch) for ch in text] + [0]
+
+
+def c_array(data, indent="\t"):
+    rows = []
+    for i in range(0, len(data), 16):
+        rows.append(indent + ", ".join("0x{:02X}".format(b) for b in data[i:i + 16]) + ",")
+    return "\n".join(rows)
+
+
+def c_comment(text):
+    return text.replace("*/", "* /")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", help="the descriptions, one 'symbol: description' per line")
+    parser.add_argument("--source", required=True, help="the C source to write")
+    parser.add_argument("--header", help="a header declaring the symbols")
+    args = parser.parse_args()
+
+    descriptions = load(args.input)
+    entries, texts = build([text for _, text in descriptions])
+
+    dictionary = []
+    for entry in entries:
+        data = [ord(ch) for ch in entry]
+        data[-1] |= 0x80
+        dictionary += data
+
+    with open(args.source, "w", newline="\r\n") as f:
+        f.write("// Generated by cmd_help.py from {}. Do not edit.\n\n".format(args.input))
+        f.write("#include \"Cmd.h\"\n\n")
+        f.write("const uint8_t Cmd_HelpDictionary[] = {\n")
+        for n, entry in enumerate(entries):
+            data = [ord(ch) for ch in entry]
+            data[-1] |= 0x80
+            f.write("{}\t// 0x{:02X} \"{}\"\n".format(c_array(data, "\t").rstrip(), 0x80 + n, c_comment(entry)))
+        if not entries:
+            f.write("\t0x80,\n")
+        f.write("};\n")
+        for (symbol, text), packed in zip(descriptions, texts):
+            f.write("\n// {}\n".format(c_comment(text)))
+            f.write("const uint8_t {}[] = {{\n{}\n}};\n".format(symbol, c_array(encode(packed))))
+
+    if args.header:
+        guard = re.sub(r"\W", "_", args.header.split("/")[-1]).upper()
+        with open(args.header, "w", newline="\r\n") as f:
+            f.write("// Generated by cmd_help.py from {}. Do not edit.\n".format(args.input))
+            f.write("#ifndef {0}\n#define {0}\n\n#include <stdint.h>\n\n".format(guard))
+            for symbol, _ in descriptions:
+                f.write("extern const uint8_t {}[];\n".format(symbol))
+            f.write("\n#endif //{}\n".format(guard))
+
+    plain = sum(len(text) + 1 for _, text in descriptions)
+    packed = sum(len(encode(text)) for text in texts) + len(dictionary)
+    print("{} descriptions, {} dictionary entries: {} bytes compressed to {} ({:.0%})".format(
+        len(descriptions), len(entries), plain, packed, packed / plain if plain else 1), file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
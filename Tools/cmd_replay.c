@@ -0,0 +1,440 @@
+
+#include "Cmd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Replays a session recorded by Cmd_SessionLog through Cmd_Parse, on the host.
+ * The input is grouped into commands by its line endings. The output of each command is compared with what was
+ * recorded, and the time taken by each is reported. Ticks are reported as commands of their own.
+ *
+ *     gcc -O2 -I <conf> -I Src Tools/cmd_replay.c tree.c Src/Cmd.c Src/CmdParse.c -o cmd_replay
+ *     ./cmd_replay session.bin               # As fast as possible
+ *     ./cmd_replay session.bin --realtime    # With the recorded gaps between input
+ *     ./cmd_replay session.bin --quiet       # Only report differences and the summary
+ *
+ * The tree source must define Replay_Root, along with anything its callbacks need in place of the hardware.
+ * It should be built against the same CmdConf.h as the device. The exit code is 1 if any output differs.
+ *
+ * Output written outside of Cmd_Parse and Cmd_Tick, such as by Cmd_Log, is recorded separately.
+ * It cannot be reproduced, so it is not compared.
+ */
+
+/*
+ * PRIVATE DEFINITIONS
+ */
+
+// These match Cmd_SessionRecord_t and Cmd_SessionFlag_t, which need not be enabled for replay.
+#define RECORD_INPUT		0
+#define RECORD_OUTPUT		1
+#define RECORD_TICK			2
+#define RECORD_ASYNC		3
+
+#define FLAG_COLOR			(1 << 0)
+#define FLAG_BELL			(1 << 1)
+#define FLAG_ECHO			(1 << 2)
+#define FLAG_PROMPT			(1 << 3)
+
+#define HEADER_SIZE			10
+#define SESSION_VERSION		2
+
+// The number of chars of differing output that are shown.
+#define SHOW_SIZE			48
+
+/*
+ * PRIVATE TYPES
+ */
+
+typedef struct {
+	uint8_t type;
+	uint64_t time;		// Since the start of the session, in microseconds
+	uint32_t size;
+	const uint8_t * data;
+} Replay_Record_t;
+
+typedef struct {
+	const uint8_t * data;
+	const uint8_t * end;
+	uint64_t time;
+} Replay_Reader_t;
+
+typedef struct {
+	uint8_t * data;
+	uint32_t size;
+	uint32_t count;
+} Replay_Buffer_t;
+
+// The records of one command, up to and including its line ending.
+typedef struct {
+	uint32_t records;
+	uint32_t recorded;	// The time the device spent on each record, in microseconds
+	uint64_t replayed;
+	uint32_t length;
+	char text[SHOW_SIZE + 1];
+} Replay_Command_t;
+
+typedef struct {
+	bool quiet;
+	uint32_t count;
+	uint32_t differences;
+	uint64_t recorded_total;
+	uint64_t replayed_total;
+	uint64_t replayed_worst;
+} Replay_Summary_t;
+
+/*
+ * PUBLIC VARIABLES
+ */
+
+extern const Cmd_Node_t Replay_Root;
+
+/*
+ * PRIVATE PROTOTYPES
+ */
+
+static uint8_t * Replay_Load(const char * path, uint32_t * size);
+static bool Replay_Next(Replay_Reader_t * reader, Replay_Record_t * record);
+static bool Replay_Varint(Replay_Reader_t * reader, uint32_t * value);
+static uint32_t Replay_Expected(Replay_Reader_t reader, Replay_Buffer_t * expected, uint64_t start);
+static bool Replay_Ends(const Replay_Record_t * record);
+static void Replay_Report(Replay_Summary_t * summary, Replay_Command_t * command, Replay_Buffer_t * expected);
+static void Replay_Append(Replay_Buffer_t * buffer, const uint8_t * data, uint32_t size);
+static void Replay_Print(const uint8_t * data, uint32_t size);
+static void Replay_Show(const char * label, const Replay_Buffer_t * buffer, uint32_t from);
+static void Replay_Describe(Replay_Command_t * command, const Replay_Record_t * record);
+static uint64_t Replay_Now(void);
+static void Replay_SleepUntil(uint64_t time);
+
+/*
+ * PRIVATE VARIABLES
+ */
+
+static Replay_Buffer_t gOutput;
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+int main(int argc, char ** argv)
+{
+	const char * path = NULL;
+	bool realtime = false;
+	bool quiet = false;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--realtime") == 0)
+		{
+			realtime = true;
+		}
+		else if (strcmp(argv[i], "--quiet") == 0)
+		{
+			quiet = true;
+		}
+		else
+		{
+			path = argv[i];
+		}
+	}
+	if (path == NULL)
+	{
+		fprintf(stderr, "usage: %s session.bin [--realtime] [--quiet]\n", argv[0]);
+		return 2;
+	}
+
+	uint32_t size;
+	uint8_t * file = Replay_Load(path, &size);
+	if (file == NULL || size < HEADER_SIZE || memcmp(file, "CmdS", 4) != 0 || file[4] != SESSION_VERSION)
+	{
+		fprintf(stderr, "%s: not a session log\n", path);
+		return 2;
+	}
+
+	// The line is set up as it was on the device, including the size of its heap.
+	uint8_t flags = file[5];
+	uint32_t heap_size = file[6] | (file[7] << 8) | (file[8] << 16) | ((uint32_t)file[9] << 24);
+	static char bfr[CMD_MAX_LINE];
+	Cmd_Heap_t heap;
+	Cmd_InitHeap(&heap, malloc(heap_size), heap_size);
+	Cmd_Line_t line;
+	Cmd_InitShared(&line, &Replay_Root, Replay_Print, bfr, &heap);
+#ifdef CMD_USE_COLOR
+	line.cfg.color = flags & FLAG_COLOR;
+#endif
+#ifdef CMD_USE_BELL
+	line.cfg.bell = flags & FLAG_BELL;
+#endif
+#ifdef CMD_USE_ECHO
+	line.cfg.echo = flags & FLAG_ECHO;
+#endif
+#ifdef CMD_PROMPT
+	line.cfg.prompt = flags & FLAG_PROMPT;
+#endif
+
+	Replay_Reader_t reader = { file + HEADER_SIZE, file + size, 0 };
+	Replay_Buffer_t expected = { 0 };
+	Replay_Record_t record;
+	Replay_Command_t command = { 0 };
+	Replay_Summary_t summary = { .quiet = quiet };
+	uint64_t start = Replay_Now();
+
+	if (!quiet)
+	{
+		printf("%6s %12s %12s  %-4s  %s\n", "row", "recorded us", "replayed us", "", "command");
+	}
+	while (Replay_Next(&reader, &record))
+	{
+		if (record.type != RECORD_INPUT && record.type != RECORD_TICK)
+		{
+			// Output before the first input, such as the prompt, is not compared.
+			continue;
+		}
+		if (record.type == RECORD_TICK && command.records)
+		{
+			// A tick is reported on its own, so ends any partly typed command.
+			Replay_Report(&summary, &command, &expected);
+		}
+		if (realtime)
+		{
+			Replay_SleepUntil(start + record.time);
+		}
+
+		// The recorded latency runs until the last output before the next input or tick.
+		// The output of each record of the command is gathered, so that it is compared as a whole.
+		command.recorded += Replay_Expected(reader, &expected, record.time);
+		uint64_t begin = Replay_Now();
+		if (record.type == RECORD_INPUT)
+		{
+			Cmd_Parse(&line, record.data, record.size);
+		}
+#ifdef CMD_USE_REPEAT
+		else if (record.type == RECORD_TICK)
+		{
+			Cmd_Tick(&line, record.size);
+		}
+#endif
+		command.replayed += Replay_Now() - begin;
+		command.records++;
+		Replay_Describe(&command, &record);
+
+		if (record.type == RECORD_TICK || Replay_Ends(&record))
+		{
+			Replay_Report(&summary, &command, &expected);
+		}
+	}
+	if (command.records)
+	{
+		// The session ended part way through a command.
+		Replay_Report(&summary, &command, &expected);
+	}
+
+	printf("%u commands, %u differ. Recorded %llu us, replayed %llu us, worst %llu us.\n",
+			summary.count, summary.differences, (unsigned long long)summary.recorded_total,
+			(unsigned long long)summary.replayed_total, (unsigned long long)summary.replayed_worst);
+	free(file);
+	free(heap.heap);
+	free(expected.data);
+	free(gOutput.data);
+	return summary.differences ? 1 : 0;
+}
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static uint8_t * Replay_Load(const char * path, uint32_t * size)
+{
+	FILE * f = fopen(path, "rb");
+	if (f == NULL)
+	{
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	long length = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint8_t * data = malloc(length > 0 ? length : 1);
+	*size = fread(data, 1, length, f);
+	fclose(f);
+	return data;
+}
+
+static bool Replay_Next(Replay_Reader_t * reader, Replay_Record_t * record)
+{
+	if (reader->data >= reader->end)
+	{
+		return false;
+	}
+	uint32_t delta;
+	record->type = *reader->data++;
+	if (!Replay_Varint(reader, &delta) || !Replay_Varint(reader, &record->size))
+	{
+		fprintf(stderr, "truncated record\n");
+		return false;
+	}
+	reader->time += delta;
+	record->time = reader->time;
+	record->data = NULL;
+	if (record->type != RECORD_TICK)
+	{
+		if (record->size > (uint32_t)(reader->end - reader->data))
+		{
+			fprintf(stderr, "truncated record\n");
+			return false;
+		}
+		record->data = reader->data;
+		reader->data += record->size;
+	}
+	return true;
+}
+
+static bool Replay_Varint(Replay_Reader_t * reader, uint32_t * value)
+{
+	*value = 0;
+	for (uint32_t shift = 0; shift < 35 && reader->data < reader->end; shift += 7)
+	{
+		uint8_t byte = *reader->data++;
+		*value |= (uint32_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static uint32_t Replay_Expected(Replay_Reader_t reader, Replay_Buffer_t * expected, uint64_t start)
+{
+	// The reader is a copy, so the following output can be gathered without consuming it.
+	// Asynchronous output may be interleaved, and is skipped.
+	Replay_Record_t record;
+	uint64_t last = start;
+	while (Replay_Next(&reader, &record) && (record.type == RECORD_OUTPUT || record.type == RECORD_ASYNC))
+	{
+		if (record.type == RECORD_OUTPUT)
+		{
+			Replay_Append(expected, record.data, record.size);
+			last = record.time;
+		}
+	}
+	return (uint32_t)(last - start);
+}
+
+static bool Replay_Ends(const Replay_Record_t * record)
+{
+	// These match the chars that run a line in Cmd_Parse.
+	for (uint32_t i = 0; i < record->size; i++)
+	{
+		uint8_t ch = record->data[i];
+		if (ch == '\r' || ch == '\n' || ch == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static void Replay_Report(Replay_Summary_t * summary, Replay_Command_t * command, Replay_Buffer_t * expected)
+{
+	// Report the first differing char, so that long outputs are readable.
+	uint32_t same = 0;
+	while (same < gOutput.count && same < expected->count && gOutput.data[same] == expected->data[same])
+	{
+		same++;
+	}
+	bool differs = same != gOutput.count || same != expected->count;
+
+	summary->count++;
+	summary->differences += differs;
+	summary->recorded_total += command->recorded;
+	summary->replayed_total += command->replayed;
+	summary->replayed_worst = command->replayed > summary->replayed_worst ? command->replayed : summary->replayed_worst;
+
+	if (!summary->quiet || differs)
+	{
+		printf("%6u %12u %12llu  %-4s  %s\n", summary->count, command->recorded,
+				(unsigned long long)command->replayed, differs ? "DIFF" : "", command->text);
+	}
+	if (differs)
+	{
+		uint32_t from = same > SHOW_SIZE / 2 ? same - SHOW_SIZE / 2 : 0;
+		Replay_Show("expected", expected, from);
+		Replay_Show("replayed", &gOutput, from);
+	}
+
+	memset(command, 0, sizeof(*command));
+	expected->count = 0;
+	gOutput.count = 0;
+}
+
+static void Replay_Append(Replay_Buffer_t * buffer, const uint8_t * data, uint32_t size)
+{
+	if (buffer->count + size > buffer->size)
+	{
+		buffer->size = (buffer->count + size) * 2;
+		buffer->data = realloc(buffer->data, buffer->size);
+	}
+	memcpy(buffer->data + buffer->count, data, size);
+	buffer->count += size;
+}
+
+static void Replay_Print(const uint8_t * data, uint32_t size)
+{
+	Replay_Append(&gOutput, data, size);
+}
+
+static void Replay_Show(const char * label, const Replay_Buffer_t * buffer, uint32_t from)
+{
+	printf("    %s: ", label);
+	for (uint32_t i = from; i < buffer->count && i < from + SHOW_SIZE; i++)
+	{
+		uint8_t ch = buffer->data[i];
+		if (ch >= ' ' && ch <= '~' && ch != '\\')
+		{
+			putchar(ch);
+		}
+		else
+		{
+			printf("\\x%02X", ch);
+		}
+	}
+	printf("%s\n", buffer->count > from + SHOW_SIZE ? "..." : "");
+}
+
+static void Replay_Describe(Replay_Command_t * command, const Replay_Record_t * record)
+{
+	char * dst = command->text + command->length;
+	uint32_t size = sizeof(command->text) - command->length;
+	if (record->type == RECORD_TICK)
+	{
+		snprintf(dst, size, "<tick %u>", record->size);
+		command->length += strlen(dst);
+		return;
+	}
+	// Control chars are shown as '.', as the input is typically a line of text.
+	uint32_t count = record->size < size - 1 ? record->size : size - 1;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint8_t ch = record->data[i];
+		dst[i] = ch >= ' ' && ch <= '~' ? ch : '.';
+	}
+	dst[count] = 0;
+	command->length += count;
+}
+
+static uint64_t Replay_Now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void Replay_SleepUntil(uint64_t time)
+{
+	uint64_t now = Replay_Now();
+	if (time > now)
+	{
+		struct timespec delay = { (time - now) / 1000000, ((time - now) % 1000000) * 1000 };
+		nanosleep(&delay, NULL);
+	}
+}
@@ -0,0 +1,366 @@
+
+#include "Cmd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Runs command scripts through Cmd_Parse on the host, several at once.
+ * Each script is mapped into memory and passed to the parser a line at a time, without copying.
+ * Its output is captured into a buffer that grows as needed, and written once the script is complete.
+ *
+ *     gcc -O2 -pthread -I <conf> -I Src Tools/cmd_script.c tree.c Src/Cmd.c Src/CmdParse.c -o cmd_script
+ *     ./cmd_script a.txt b.txt               # Writes the output of each script to stdout, in order
+ *     ./cmd_script --out .log *.txt          # Writes the output of each script to a.txt.log, b.txt.log...
+ *     ./cmd_script --jobs 4 --times *.txt    # Limits the threads, and reports the time taken by each command
+ *     ./cmd_script --echo a.txt              # Includes the prompt and echoed input, as on a terminal
+ *
+ * The tree source must define Script_Root. Each script runs on its own Cmd_Line_t and heap,
+ * but the callbacks of the tree are shared, so they must be safe to run on several threads at once.
+ * Use --jobs 1 if they are not. CMD_USE_TRACE keeps a single trace for all lines, so it should not be enabled.
+ *
+ * The output is the same as if the script were passed to Cmd_Parse a byte at a time.
+ * The time taken by each script is reported to stderr. The exit code is 1 if any script could not be read.
+ */
+
+/*
+ * PRIVATE DEFINITIONS
+ */
+
+#define HEAP_SIZE			4096
+#define OUTPUT_SIZE			65536
+
+/*
+ * PRIVATE TYPES
+ */
+
+typedef struct {
+	uint32_t number;	// The line of the script, from 1
+	uint32_t offset;
+	uint32_t size;		// Excluding the line ending
+	uint64_t time;		// In microseconds
+} Script_Command_t;
+
+typedef struct {
+	const char * path;
+	bool failed;
+	Cmd_Capture_t output;
+	Script_Command_t * commands;
+	uint32_t count;
+	uint32_t size;
+	uint64_t time;
+	const uint8_t * data;	// The mapped script. This is kept so that the commands can be reported.
+	uint32_t length;
+} Script_t;
+
+typedef struct {
+	Script_t * scripts;
+	uint32_t count;
+	uint32_t next;
+	pthread_mutex_t lock;
+	uint32_t heap_size;
+	bool echo;
+} Script_Queue_t;
+
+/*
+ * PUBLIC VARIABLES
+ */
+
+extern const Cmd_Node_t Script_Root;
+
+/*
+ * PRIVATE PROTOTYPES
+ */
+
+static void * Script_Worker(void * arg);
+static void Script_Run(const Script_Queue_t * queue, Script_t * script, Cmd_Line_t * line, void * heap);
+static void Script_AddCommand(Script_t * script, uint32_t number, uint32_t offset, uint32_t size, uint64_t time);
+static void Script_Grow(Cmd_Capture_t * capture);
+static void Script_Print(const uint8_t * data, uint32_t size);
+static void Script_Report(const Script_t * script, bool times);
+static bool Script_WriteFile(const char * path, const char * suffix, const uint8_t * data, uint32_t size);
+static uint64_t Script_Now(void);
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+int main(int argc, char ** argv)
+{
+	const char * suffix = NULL;
+	bool times = false;
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	Script_Queue_t queue = { 0 };
+	queue.heap_size = HEAP_SIZE;
+	queue.scripts = calloc(argc, sizeof(Script_t));
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--times") == 0)
+		{
+			times = true;
+		}
+		else if (strcmp(argv[i], "--echo") == 0)
+		{
+			queue.echo = true;
+		}
+		else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+		{
+			jobs = atol(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--heap") == 0 && i + 1 < argc)
+		{
+			queue.heap_size = atol(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+		{
+			suffix = argv[++i];
+		}
+		else
+		{
+			queue.scripts[queue.count++].path = argv[i];
+		}
+	}
+	if (queue.count == 0)
+	{
+		fprintf(stderr, "usage: %s script.txt... [--jobs n] [--times] [--echo] [--out suffix] [--heap size]\n", argv[0]);
+		return 2;
+	}
+
+	// There is no point having more threads than scripts.
+	jobs = jobs < 1 ? 1 : jobs;
+	jobs = jobs > (long)queue.count ? (long)queue.count : jobs;
+	pthread_mutex_init(&queue.lock, NULL);
+	pthread_t * threads = malloc(jobs * sizeof(pthread_t));
+	uint64_t start = Script_Now();
+	for (long i = 0; i < jobs; i++)
+	{
+		pthread_create(&threads[i], NULL, Script_Worker, &queue);
+	}
+	for (long i = 0; i < jobs; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	uint64_t elapsed = Script_Now() - start;
+
+	// The results are written in the order of the scripts, regardless of the order in which they finished.
+	uint32_t failures = 0;
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < queue.count; i++)
+	{
+		Script_t * script = &queue.scripts[i];
+		if (!script->failed)
+		{
+			if (suffix != NULL)
+			{
+				script->failed = !Script_WriteFile(script->path, suffix, script->output.data, script->output.count);
+			}
+			else
+			{
+				fwrite(script->output.data, 1, script->output.count, stdout);
+			}
+		}
+		Script_Report(script, times);
+		failures += script->failed;
+		total += script->time;
+		if (script->data != NULL)
+		{
+			munmap((void *)script->data, script->length);
+		}
+		free(script->output.data);
+		free(script->commands);
+	}
+	fflush(stdout);
+
+	fprintf(stderr, "%u scripts, %u failed, on %ld threads. Parsing took %llu us, elapsed %llu us.\n",
+			queue.count, failures, jobs, (unsigned long long)total, (unsigned long long)elapsed);
+	pthread_mutex_destroy(&queue.lock);
+	free(threads);
+	free(queue.scripts);
+	return failures ? 1 : 0;
+}
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static void * Script_Worker(void * arg)
+{
+	Script_Queue_t * queue = arg;
+
+	// Each thread has its own line and heap, which are reused for each of its scripts.
+	void * heap = malloc(queue->heap_size);
+	Cmd_Line_t line;
+
+	while (1)
+	{
+		pthread_mutex_lock(&queue->lock);
+		uint32_t index = queue->next++;
+		pthread_mutex_unlock(&queue->lock);
+		if (index >= queue->count)
+		{
+			break;
+		}
+		Script_Run(queue, &queue->scripts[index], &line, heap);
+	}
+
+	free(heap);
+	return NULL;
+}
+
+static void Script_Run(const Script_Queue_t * queue, Script_t * script, Cmd_Line_t * line, void * heap)
+{
+	int fd = open(script->path, O_RDONLY);
+	struct stat info;
+	if (fd < 0 || fstat(fd, &info) != 0)
+	{
+		script->failed = true;
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return;
+	}
+	script->length = info.st_size;
+	if (script->length)
+	{
+		void * map = mmap(NULL, script->length, PROT_READ, MAP_PRIVATE, fd, 0);
+		script->data = map == MAP_FAILED ? NULL : map;
+		script->failed = script->data == NULL;
+	}
+	close(fd);
+	if (script->failed)
+	{
+		return;
+	}
+
+	script->output.data = malloc(OUTPUT_SIZE);
+	script->output.size = OUTPUT_SIZE;
+	script->output.count = 0;
+	script->output.flush = Script_Grow;
+
+	// Cmd_Init clears the configuration, so writes nothing. The line is started again once the capture is attached,
+	// so that the first prompt is captured along with the rest.
+	Cmd_Init(line, &Script_Root, Script_Print, heap, queue->heap_size);
+#ifdef CMD_USE_ECHO
+	line->cfg.echo = queue->echo;
+#endif
+#ifdef CMD_PROMPT
+	line->cfg.prompt = queue->echo;
+#endif
+	Cmd_Capture(line, &script->output);
+	Cmd_Start(line);
+
+	// Each line is passed on with its line ending, so that it is run before it is timed.
+	const uint8_t * data = script->data;
+	uint32_t offset = 0;
+	uint32_t number = 1;
+	uint64_t start = Script_Now();
+	while (offset < script->length)
+	{
+		uint32_t end = offset;
+		while (end < script->length && data[end] != '\r' && data[end] != '\n')
+		{
+			end++;
+		}
+		uint32_t next = end;
+		if (next < script->length)
+		{
+			next += (data[next] == '\r' && next + 1 < script->length && data[next + 1] == '\n') ? 2 : 1;
+		}
+
+		uint64_t begin = Script_Now();
+		Cmd_Parse(line, data + offset, next - offset);
+		uint64_t now = Script_Now();
+		if (end > offset)
+		{
+			Script_AddCommand(script, number, offset, end - offset, now - begin);
+		}
+		offset = next;
+		number++;
+	}
+	script->time = Script_Now() - start;
+	Cmd_Capture(line, NULL);
+}
+
+static void Script_AddCommand(Script_t * script, uint32_t number, uint32_t offset, uint32_t size, uint64_t time)
+{
+	if (script->count == script->size)
+	{
+		script->size = script->size ? script->size * 2 : 64;
+		script->commands = realloc(script->commands, script->size * sizeof(Script_Command_t));
+	}
+	Script_Command_t * command = &script->commands[script->count++];
+	command->number = number;
+	command->offset = offset;
+	command->size = size;
+	command->time = time;
+}
+
+static void Script_Grow(Cmd_Capture_t * capture)
+{
+	// Rather than emptying the buffer, it is made larger. The output is written once the script is complete.
+	capture->size *= 2;
+	capture->data = realloc(capture->data, capture->size);
+}
+
+static void Script_Print(const uint8_t * data, uint32_t size)
+{
+	// All output is captured while a script runs, so there is nothing to do.
+	(void)data;
+	(void)size;
+}
+
+static void Script_Report(const Script_t * script, bool times)
+{
+	if (script->failed)
+	{
+		fprintf(stderr, "%s: could not be run\n", script->path);
+		return;
+	}
+	const Script_Command_t * worst = NULL;
+	for (uint32_t i = 0; i < script->count; i++)
+	{
+		const Script_Command_t * command = &script->commands[i];
+		if (times)
+		{
+			fprintf(stderr, "%s:%u %10llu us  %.*s\n", script->path, command->number,
+					(unsigned long long)command->time, (int)command->size, script->data + command->offset);
+		}
+		worst = (worst == NULL || command->time > worst->time) ? command : worst;
+	}
+	fprintf(stderr, "%s: %u commands in %llu us", script->path, script->count, (unsigned long long)script->time);
+	if (worst != NULL)
+	{
+		fprintf(stderr, ", worst %llu us on line %u", (unsigned long long)worst->time, worst->number);
+	}
+	fprintf(stderr, ". %u bytes of output.\n", script->output.count);
+}
+
+static bool Script_WriteFile(const char * path, const char * suffix, const uint8_t * data, uint32_t size)
+{
+	char * name = malloc(strlen(path) + strlen(suffix) + 1);
+	strcpy(name, path);
+	strcat(name, suffix);
+	FILE * f = fopen(name, "wb");
+	free(name);
+	if (f == NULL)
+	{
+		return false;
+	}
+	bool written = fwrite(data, 1, size, f) == size;
+	return fclose(f) == 0 && written;
+}
+
+static uint64_t Script_Now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+"""
+Expands the compressed streams written by Cmd_BeginStream, Cmd_WriteStream and Cmd_EndStream.
+
+The input is a capture of the link, which may contain other output around the streams.
+Each stream found is written to the output, or to numbered files if there are several.
+
+    python3 cmd_stream.py capture.bin -o image.bin
+
+A stream is "CmdZ", the window size less one as a byte, the compressed data, and the uint32_t uncompressed size.
+The data is in groups of a flag byte followed by 8 items, with the first item in the lowest bit.
+A clear bit is a literal byte. A set bit is a match of two bytes: the distance back less one, and the length less three.
+A match length byte of 0xFF ends the data.
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = b"CmdZ"
+MIN_MATCH = 3
+END = 0xFF
+
+
+def expand(data, offset):
+    # Returns the expanded stream, and the offset after it.
+    out = bytearray()
+    pos = offset
+    while True:
+        if pos >= len(data):
+            raise ValueError("truncated stream")
+        flags = data[pos]
+        pos += 1
+        for bit in range(8):
+            if pos >= len(data):
+                raise ValueError("truncated stream")
+            if not flags & (1 << bit):
+                out.append(data[pos])
+                pos += 1
+                continue
+            if pos + 2 > len(data):
+                raise ValueError("truncated stream")
+            distance, length = data[pos] + 1, data[pos + 1]
+            pos += 2
+            if length == END:
+                if pos + 4 > len(data):
+                    raise ValueError("truncated stream")
+                (size,) = struct.unpack_from("<I", data, pos)
+                if size != len(out):
+                    raise ValueError("expanded to {} bytes, but {} were written".format(len(out), size))
+                return bytes(out), pos + 4
+            if distance > len(out):
+                raise ValueError("match before the start of the stream")
+            # The source may overlap the bytes being produced, so they are copied one at a time.
+            for _ in range(length + MIN_MATCH):
+                out.append(out[-distance])
+
+
+def find_streams(data):
+    streams = []
+    offset = data.find(MAGIC)
+    while offset >= 0:
+        start = offset
+        try:
+            payload, offset = expand(data, offset + len(MAGIC) + 1)
+        except ValueError:
+            # Other output may happen to contain the magic, so the search carries on after it.
+            offset = data.find(MAGIC, start + 1)
+            continue
+        streams.append((start, offset - start, payload))
+        offset = data.find(MAGIC, offset)
+    return streams
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", help="a capture containing one or more streams")
+    parser.add_argument("-o", "--output", help="the file to write, numbered if there is more than one stream")
+    args = parser.parse_args()
+
+    with open(args.input, "rb") as f:
+        data = f.read()
+    streams = find_streams(data)
+    if not streams:
+        print("no streams found", file=sys.stderr)
+        return 1
+
+    for n, (start, size, payload) in enumerate(streams):
+        print("stream at {}: {} bytes expanded to {} ({:.1f}x)".format(
+            start, size, len(payload), len(payload) / size), file=sys.stderr)
+        if args.output:
+            path = args.output if len(streams) == 1 else "{}.{}".format(args.output, n)
+            with open(path, "wb") as f:
+                f.write(payload)
+        else:
+            sys.stdout.buffer.write(payload)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+"""
+Decodes the output of the 'trace' command into a timeline.
+
+The input may be the binary output of 'trace dump', or the text output of 'trace show'.
+Node addresses can be named by providing the output of 'nm' for the firmware image.
+
+    nm firmware.elf > symbols.txt
+    python3 cmd_trace.py capture.bin --symbols symbols.txt
+"""
+
+import argparse
+import struct
+import sys
+
+EVENT_NAMES = ["line", "node", "argerror", "enter", "exit", "overrun", "flush", "discard"]
+ADDRESS_EVENTS = {"node", "enter", "exit"}
+ADDRESS_MASK = 0xFFFFFF
+
+
+def load_symbols(path):
+    symbols = {}
+    with open(path) as f:
+        for row in f:
+            parts = row.split()
+            if len(parts) == 3:
+                try:
+                    symbols[int(parts[0], 16) & ADDRESS_MASK] = parts[2]
+                except ValueError:
+                    pass
+    return symbols
+
+
+def parse_binary(data, endian):
+    start = data.find(b"CmdT")
+    if start < 0:
+        raise ValueError("no trace dump found")
+    (count,) = struct.unpack_from(endian + "I", data, start + 4)
+    events = []
+    offset = start + 8
+    for _ in range(count):
+        time, event = struct.unpack_from(endian + "II", data, offset)
+        offset += 8
+        kind = event & 0xFF
+        name = EVENT_NAMES[kind] if kind < len(EVENT_NAMES) else "?"
+        events.append((time, name, event >> 8))
+    return events
+
+
+def parse_text(text):
+    events = []
+    for row in text.splitlines():
+        parts = row.strip().lstrip("> ").split()
+        if len(parts) == 3 and parts[0].isdigit():
+            events.append((int(parts[0]), parts[1], int(parts[2], 0)))
+    return events
+
+
+def print_timeline(events, symbols):
+    # Callbacks are nested by their enter and exit events, so that their durations can be shown.
+    stack = []
+    last = events[0][0] if events else 0
+    print("{:>10} {:>8}  event".format("time", "delta"))
+    for time, name, arg in events:
+        if name in ADDRESS_EVENTS:
+            detail = symbols.get(arg, "0x{:06X}".format(arg))
+        else:
+            detail = str(arg)
+        if name == "exit":
+            while stack and stack[-1][1] != arg:
+                stack.pop()
+            if stack:
+                detail += " ({} elapsed)".format(time - stack.pop()[0])
+        indent = "  " * len(stack)
+        print("{:>10} {:>+8}  {}{} {}".format(time, time - last, indent, name, detail))
+        if name == "enter":
+            stack.append((time, arg))
+        last = time
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", help="binary or text trace capture")
+    parser.add_argument("--symbols", help="output of nm, used to name node addresses")
+    parser.add_argument("--big-endian", action="store_true", help="the target is big endian")
+    args = parser.parse_args()
+
+    with open(args.input, "rb") as f:
+        data = f.read()
+    if b"CmdT" in data:
+        events = parse_binary(data, ">" if args.big_endian else "<")
+    else:
+        events = parse_text(data.decode(errors="replace"))
+
+    symbols = load_symbols(args.symbols) if args.symbols else {}
+    print_timeline(events, symbols)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,269 @@
+#!/usr/bin/env python3
+"""
+Measures the cost of the CmdConf.h feature switches.
+
+Each configuration is derived from Templates/CmdConf.h, and Src/ is built for every available target.
+The report gives .text/.data/.bss, the worst case stack depth from GCC's static call graph,
+and the heap and stack high water marks of the reference session in footprint_ref.c (host only).
+
+    python3 footprint.py                  # The default, minimal, and single feature changes
+    python3 footprint.py --pairs          # Every pair of switches, with what they require
+    python3 footprint.py --check          # Fail if anything has grown beyond the baseline
+    python3 footprint.py --update         # Rewrite the baseline
+
+Static stack depths do not include callbacks, which are called indirectly. Recursive paths are
+marked with a '+', as their depth grows with the menu tree. The measured stack includes the
+reference callbacks and the C library.
+"""
+
+import argparse
+import itertools
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+TEMPLATE = os.path.join(ROOT, "Templates", "CmdConf.h")
+SOURCES = [os.path.join(ROOT, "Src", name) for name in ("Cmd.c", "CmdParse.c", "CmdMux.c")]
+REFERENCE = os.path.join(ROOT, "Tools", "footprint_ref.c")
+REFERENCE_HELP = os.path.join(ROOT, "Tools", "footprint_help.txt")
+HELP_TOOL = os.path.join(ROOT, "Tools", "cmd_help.py")
+BASELINE = os.path.join(ROOT, "Tools", "footprint_baseline.json")
+
+# Every configuration is also built as a warning check.
+WARNINGS = ["-Wall", "-Wextra", "-Werror"]
+TARGETS = {
+    "cortex-m0": {"cc": "arm-none-eabi-gcc", "size": "arm-none-eabi-size",
+                  "flags": ["-mcpu=cortex-m0plus", "-mthumb", "-Os"] + WARNINGS},
+    "cortex-m4": {"cc": "arm-none-eabi-gcc", "size": "arm-none-eabi-size",
+                  "flags": ["-mcpu=cortex-m4", "-mthumb", "-Os"] + WARNINGS},
+    "host": {"cc": "gcc", "size": "size", "flags": ["-Os"] + WARNINGS},
+}
+
+SWITCH = re.compile(r"^(//)?#define\s+(CMD_USE_\w+|CMD_HELP_TOKEN|CMD_PROMPT)\b")
+REQUIRES = re.compile(r"requires\s+(CMD_\w+)")
+
+
+class Template:
+    def __init__(self, path):
+        with open(path) as f:
+            self.lines = f.read().splitlines()
+        self.defaults = {}
+        self.requires = {}
+        comments = []
+        for line in self.lines:
+            match = SWITCH.match(line)
+            if match:
+                name = match.group(2)
+                self.defaults[name] = match.group(1) is None
+                self.requires[name] = [r for c in comments for r in REQUIRES.findall(c)]
+            comments = comments + [line] if line.startswith("//") and not match else []
+
+    def render(self, enabled):
+        out = []
+        for line in self.lines:
+            match = SWITCH.match(line)
+            if match:
+                body = line[2:] if match.group(1) else line
+                line = body if match.group(2) in enabled else "//" + body
+            out.append(line)
+        return "\n".join(out) + "\n"
+
+    def closure(self, enabled):
+        # Add anything required by the enabled switches.
+        enabled = set(enabled)
+        while True:
+            extra = {r for name in enabled for r in self.requires[name]} - enabled
+            if not extra:
+                return enabled
+            enabled |= extra
+
+    def dependents(self, name):
+        return {n for n, reqs in self.requires.items() if name in reqs}
+
+
+def configurations(template, pairs):
+    default = {n for n, on in template.defaults.items() if on}
+    if pairs:
+        # Every combination would be 2^N builds. Pairs catch most interactions between switches, in N^2 / 2.
+        seen = set()
+        for a, b in itertools.combinations(sorted(template.defaults), 2):
+            enabled = frozenset(template.closure({a, b}))
+            if enabled not in seen:
+                seen.add(enabled)
+                yield "+".join(sorted(n.replace("CMD_USE_", "") for n in enabled)), set(enabled)
+        return
+    yield "default", default
+    yield "minimal", set()
+    for name in sorted(template.defaults):
+        if name in default:
+            yield "no " + name, default - {name} - template.dependents(name)
+        else:
+            yield "with " + name, template.closure(default | {name})
+
+
+def run(args, cwd):
+    result = subprocess.run(args, cwd=cwd, capture_output=True, text=True)
+    if result.returncode != 0:
+        raise RuntimeError("{} failed:\n{}".format(" ".join(args), result.stderr))
+    return result.stdout
+
+
+def measure_size(target, objects, cwd):
+    text = data = bss = 0
+    for row in run([target["size"]] + objects, cwd).splitlines()[1:]:
+        fields = row.split()
+        text += int(fields[0])
+        data += int(fields[1])
+        bss += int(fields[2])
+    return text, data, bss
+
+
+def measure_stack(cwd):
+    # Parse the callgraph-info output, which holds each function's frame and its direct calls.
+    frames = {}
+    calls = {}
+    for name in os.listdir(cwd):
+        if not name.endswith(".ci"):
+            continue
+        with open(os.path.join(cwd, name)) as f:
+            for row in f:
+                node = re.match(r'node: \{ title: "(?:[^"]*:)?([^":]+)" label: "[^"]*\\n(\d+) bytes', row)
+                if node:
+                    frames[node.group(1)] = int(node.group(2))
+                    calls.setdefault(node.group(1), set())
+                edge = re.match(r'edge: \{ sourcename: "(?:[^"]*:)?([^":]+)" targetname: "(?:[^"]*:)?([^":]+)"', row)
+                if edge and edge.group(2) != "__indirect_call":
+                    calls.setdefault(edge.group(1), set()).add(edge.group(2))
+
+    depth = {}
+    recursive = set()
+
+    def visit(name, path):
+        if name in path:
+            recursive.update(path[path.index(name):])
+            return 0
+        if name in depth:
+            return depth[name]
+        deepest = max((visit(callee, path + [name]) for callee in calls.get(name, ())), default=0)
+        depth[name] = frames.get(name, 0) + deepest
+        return depth[name]
+
+    worst = max(frames, key=lambda name: visit(name, []))
+    return depth[worst], worst, bool(recursive)
+
+
+def measure_session(target, cwd):
+    # Symbols are bound at load time, as lazy binding would add the dynamic linker to the stack measurement.
+    exe = os.path.join(cwd, "footprint_ref")
+    help_source = os.path.join(cwd, "footprint_help.c")
+    run([sys.executable, HELP_TOOL, REFERENCE_HELP, "--source", help_source,
+        "--header", os.path.join(cwd, "footprint_help.h")], cwd)
+    run([target["cc"]] + target["flags"] + ["-Wl,-z,now", "-I", cwd, "-I", os.path.join(ROOT, "Src"),
+        "-o", exe, REFERENCE, help_source] + SOURCES, cwd)
+    results = {}
+    for row in run([exe], cwd).splitlines():
+        key, value = row.split()
+        results[key] = int(value)
+    return results["heap"], results["stack"]
+
+
+def measure(target_name, target, config, workdir):
+    with open(os.path.join(workdir, "CmdConf.h"), "w") as f:
+        f.write(config)
+    objects = []
+    for source in SOURCES:
+        obj = os.path.splitext(os.path.basename(source))[0] + ".o"
+        run([target["cc"]] + target["flags"] + ["-c", "-fstack-usage", "-fcallgraph-info=su",
+            "-I", workdir, "-I", os.path.join(ROOT, "Src"), "-o", obj, source], workdir)
+        objects.append(obj)
+    text, data, bss = measure_size(target, objects, workdir)
+    stack, entry, recursive = measure_stack(workdir)
+    result = {"text": text, "data": data, "bss": bss, "stack": stack, "stack_entry": entry, "recursive": recursive}
+    if target_name == "host":
+        result["heap"], result["measured"] = measure_session(target, workdir)
+    return result
+
+
+def report(results, baseline):
+    columns = ["text", "data", "bss", "stack", "measured", "heap"]
+    print("{:<10} {:<34}".format("target", "config") + "".join("{:>14}".format(c) for c in columns))
+    for target, configs in results.items():
+        default = configs.get("default", {})
+        for name, result in configs.items():
+            cells = []
+            for column in columns:
+                if column not in result:
+                    cells.append("-")
+                    continue
+                value = str(result[column])
+                if column == "stack" and result["recursive"]:
+                    value += "+"
+                if name != "default" and column in default:
+                    value += " ({:+d})".format(result[column] - default[column])
+                cells.append(value)
+            print("{:<10} {:<34}".format(target, name) + "".join("{:>14}".format(c) for c in cells))
+
+
+def check(results, baseline, tolerance):
+    regressions = []
+    for target, configs in results.items():
+        for name, result in configs.items():
+            previous = baseline.get(target, {}).get(name)
+            if previous is None:
+                continue
+            for column in ("text", "data", "bss", "stack", "measured", "heap"):
+                if column in previous and column in result and result[column] > previous[column] + tolerance:
+                    regressions.append("{} {}: {} grew from {} to {}".format(target, name, column, previous[column], result[column]))
+            if result["recursive"] and not previous.get("recursive", False):
+                regressions.append("{} {}: stack is now recursive".format(target, name))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--target", action="append", choices=sorted(TARGETS), help="limit to these targets")
+    parser.add_argument("--pairs", action="store_true", help="measure every pair of switches on the minimal configuration")
+    parser.add_argument("--check", action="store_true", help="fail on growth beyond the baseline")
+    parser.add_argument("--update", action="store_true", help="write the results as the new baseline")
+    parser.add_argument("--tolerance", type=int, default=0, help="bytes of growth allowed by --check")
+    args = parser.parse_args()
+
+    template = Template(TEMPLATE)
+    results = {}
+    for target_name in args.target or sorted(TARGETS):
+        target = TARGETS[target_name]
+        if shutil.which(target["cc"]) is None:
+            print("skipping {}: {} not found".format(target_name, target["cc"]), file=sys.stderr)
+            continue
+        results[target_name] = {}
+        for name, enabled in configurations(template, args.pairs):
+            with tempfile.TemporaryDirectory() as workdir:
+                results[target_name][name] = measure(target_name, target, template.render(enabled), workdir)
+
+    baseline = {}
+    if os.path.exists(BASELINE):
+        with open(BASELINE) as f:
+            baseline = json.load(f)
+    report(results, baseline)
+
+    if args.update:
+        for target, configs in results.items():
+            baseline.setdefault(target, {}).update(configs)
+        with open(BASELINE, "w") as f:
+            json.dump(baseline, f, indent=1, sort_keys=True)
+            f.write("\n")
+    if args.check:
+        regressions = check(results, baseline, args.tolerance)
+        for regression in regressions:
+            print("REGRESSION: " + regression, file=sys.stderr)
+        return 1 if regressions else 0
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,554 @@
+
+#include "Cmd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+
+/*
+ * A reference tree and session, used by footprint.py to measure the heap and stack needed for a configuration.
+ * This is built for the host, against the CmdConf.h being measured.
+ */
+
+/*
+ * PRIVATE DEFINITIONS
+ */
+
+#define HEAP_SIZE		(CMD_MAX_LINE * 8)
+#define HEAP_PAINT		0xA5
+
+#define STACK_SIZE		16384
+#define STACK_PAINT		0x5A
+
+#ifdef CMD_USE_STREAM
+#define IMAGE_SIZE		8192
+#define IMAGE_GAP		128
+#define IMAGE_SPAN		256
+#endif
+
+#ifdef CMD_USE_HELP_TEXT
+#include "footprint_help.h"
+#define REF_ARGUMENT(_type, _name, _help)				CMD_ARGUMENT_HELP(_type, _name, _help)
+#define REF_AFUNCTION(_name, _callback, _arglist, _help)	CMD_AFUNCTION_HELP(_name, _callback, _arglist, _help)
+#define REF_MENU(_name, _nodelist, _help)				CMD_MENU_HELP(_name, _nodelist, _help)
+#else
+#define REF_ARGUMENT(_type, _name, _help)				CMD_ARGUMENT(_type, _name)
+#define REF_AFUNCTION(_name, _callback, _arglist, _help)	CMD_AFUNCTION(_name, _callback, _arglist)
+#define REF_MENU(_name, _nodelist, _help)				CMD_MENU(_name, _nodelist)
+#endif
+
+/*
+ * PRIVATE PROTOTYPES
+ */
+
+static void Ref_Print(const uint8_t * data, uint32_t size);
+#ifdef CMD_USE_SESSION_LOG
+static void Ref_SessionWrite(const uint8_t * data, uint32_t size);
+#endif
+static void Ref_ReadFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args);
+#ifdef CMD_USE_BYTE_ARGS
+static void Ref_WriteFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args);
+#endif
+#ifdef CMD_USE_STRING_ARGS
+static void Ref_NameFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args);
+#endif
+#ifdef CMD_USE_BOOL_ARGS
+static void Ref_EnableFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args);
+#endif
+#ifdef CMD_USE_LIST_ARGS
+static void Ref_BlockFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args);
+#endif
+#ifdef CMD_USE_RECORDS
+static void Ref_StatusFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args);
+#endif
+#ifdef CMD_USE_DUMP
+static void Ref_DumpFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args);
+#endif
+#ifdef CMD_USE_STREAM
+static void Ref_ImageFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args);
+static uint32_t Ref_Expand(const uint8_t * src, uint32_t size, uint8_t * dst, uint32_t capacity);
+#endif
+#ifdef CMD_USE_CHOICE_ARGS
+static void Ref_ModeFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args);
+#endif
+#ifdef CMD_USE_VARIADIC_ARGS
+static void Ref_SumFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args);
+#endif
+static void Ref_Session(void);
+static uint32_t Ref_HeapUsed(const uint8_t * heap, uint32_t size);
+static uint32_t Ref_StackUsed(const uint8_t * stack, uint32_t size);
+
+/*
+ * PRIVATE VARIABLES
+ */
+
+static const Cmd_Arg_t gReadArgs[] = {
+	REF_ARGUMENT(Cmd_Arg_Number, "address", ref_read_address_help),
+	REF_ARGUMENT(Cmd_Arg_Number | Cmd_Arg_Optional, "count", ref_read_count_help),
+};
+static const Cmd_Node_t gReadNode = REF_AFUNCTION("read", Ref_ReadFunction, gReadArgs, ref_read_help);
+
+#ifdef CMD_USE_BYTE_ARGS
+static const Cmd_Arg_t gWriteArgs[] = {
+	CMD_ARGUMENT(Cmd_Arg_Number, "address"),
+	CMD_ARGUMENT(Cmd_Arg_Bytes, "data"),
+};
+static const Cmd_Node_t gWriteNode = REF_AFUNCTION("write", Ref_WriteFunction, gWriteArgs, ref_write_help);
+#endif
+
+#ifdef CMD_USE_STRING_ARGS
+static const Cmd_Arg_t gNameArgs[] = {
+	CMD_ARGUMENT(Cmd_Arg_String, "name"),
+};
+static const Cmd_Node_t gNameNode = CMD_AFUNCTION("name", Ref_NameFunction, gNameArgs);
+#endif
+
+#ifdef CMD_USE_BOOL_ARGS
+static const Cmd_Arg_t gEnableArgs[] = {
+	CMD_ARGUMENT(Cmd_Arg_Bool, "state"),
+};
+static const Cmd_Node_t gEnableNode = CMD_AFUNCTION("enable", Ref_EnableFunction, gEnableArgs);
+#endif
+
+#ifdef CMD_USE_LIST_ARGS
+static const Cmd_Arg_t gBlockArgs[] = {
+	CMD_ARGUMENT(Cmd_Arg_Number, "address"),
+	CMD_ARGUMENT(Cmd_Arg_List16, "values"),
+};
+static const Cmd_Node_t gBlockNode = CMD_AFUNCTION("block", Ref_BlockFunction, gBlockArgs);
+#endif
+
+#ifdef CMD_USE_RECORDS
+static const Cmd_Node_t gStatusNode = CMD_FUNCTION("status", Ref_StatusFunction);
+#endif
+
+#ifdef CMD_USE_DUMP
+static const Cmd_Arg_t gDumpArgs[] = {
+	CMD_ARGUMENT(Cmd_Arg_Number, "count"),
+};
+static const Cmd_Node_t gDumpNode = CMD_AFUNCTION("dump", Ref_DumpFunction, gDumpArgs);
+#endif
+
+#ifdef CMD_USE_STREAM
+static const Cmd_Arg_t gImageArgs[] = {
+	CMD_ARGUMENT(Cmd_Arg_Number, "count"),
+};
+static const Cmd_Node_t gImageNode = CMD_AFUNCTION("image", Ref_ImageFunction, gImageArgs);
+#endif
+
+#ifdef CMD_USE_CHOICE_ARGS
+static const char * const gModeNames[] = { "slow", "normal", "fast", "turbo" };
+static const uint8_t gModeIndex[] = { 2, 1, 0, 3 };
+static const Cmd_Choices_t gModes = CMD_ICHOICES(gModeNames, gModeIndex);
+static const Cmd_Arg_t gModeArgs[] = {
+	CMD_CHOICE_ARGUMENT(Cmd_Arg_Choice, "mode", &gModes),
+};
+static const Cmd_Node_t gModeNode = CMD_AFUNCTION("mode", Ref_ModeFunction, gModeArgs);
+#endif
+
+#ifdef CMD_USE_VARIADIC_ARGS
+static const Cmd_Arg_t gSumArgs[] = {
+	CMD_ARGUMENT(Cmd_Arg_Number | Cmd_Arg_Variadic, "values"),
+};
+static const Cmd_Node_t gSumNode = CMD_AFUNCTION("sum", Ref_SumFunction, gSumArgs);
+#endif
+
+static const Cmd_Node_t * const gSpiItems[] = {
+	&gReadNode,
+#ifdef CMD_USE_BYTE_ARGS
+	&gWriteNode,
+#endif
+#ifdef CMD_USE_STRING_ARGS
+	&gNameNode,
+#endif
+#ifdef CMD_USE_BOOL_ARGS
+	&gEnableNode,
+#endif
+#ifdef CMD_USE_LIST_ARGS
+	&gBlockNode,
+#endif
+#ifdef CMD_USE_RECORDS
+	&gStatusNode,
+#endif
+#ifdef CMD_USE_DUMP
+	&gDumpNode,
+#endif
+#ifdef CMD_USE_STREAM
+	&gImageNode,
+#endif
+#ifdef CMD_USE_CHOICE_ARGS
+	&gModeNode,
+#endif
+#ifdef CMD_USE_VARIADIC_ARGS
+	&gSumNode,
+#endif
+};
+static const Cmd_Node_t gSpiMenu = REF_MENU("spi", gSpiItems, ref_spi_help);
+
+static const Cmd_Node_t * const gBusItems[] = {
+	&gSpiMenu,
+};
+static const Cmd_Node_t gBusMenu = CMD_MENU("bus", gBusItems);
+
+// A deep tree, to show that the stack use does not depend on depth.
+static const Cmd_Node_t * const gLevel1Items[] = { &gSpiMenu };
+static const Cmd_Node_t gLevel1Menu = CMD_MENU("l1", gLevel1Items);
+static const Cmd_Node_t * const gLevel2Items[] = { &gLevel1Menu };
+static const Cmd_Node_t gLevel2Menu = CMD_MENU("l2", gLevel2Items);
+static const Cmd_Node_t * const gLevel3Items[] = { &gLevel2Menu };
+static const Cmd_Node_t gLevel3Menu = CMD_MENU("l3", gLevel3Items);
+static const Cmd_Node_t * const gLevel4Items[] = { &gLevel3Menu };
+static const Cmd_Node_t gLevel4Menu = CMD_MENU("l4", gLevel4Items);
+static const Cmd_Node_t * const gLevel5Items[] = { &gLevel4Menu };
+static const Cmd_Node_t gLevel5Menu = CMD_MENU("l5", gLevel5Items);
+static const Cmd_Node_t * const gLevel6Items[] = { &gLevel5Menu };
+static const Cmd_Node_t gLevel6Menu = CMD_MENU("l6", gLevel6Items);
+static const Cmd_Node_t * const gLevel7Items[] = { &gLevel6Menu };
+static const Cmd_Node_t gLevel7Menu = CMD_MENU("l7", gLevel7Items);
+static const Cmd_Node_t * const gLevel8Items[] = { &gLevel7Menu };
+static const Cmd_Node_t gLevel8Menu = CMD_MENU("l8", gLevel8Items);
+
+#ifdef CMD_USE_MENU_POOLS
+// Modules attach their menus to this at start up.
+static const Cmd_Node_t * gModuleSlots[4];
+static uint8_t gModuleIndex[4];
+static Cmd_MenuPool_t gModulePool = CMD_MENU_POOL("mod", gModuleSlots, gModuleIndex);
+#endif
+
+static const Cmd_Node_t * const gRootItems[] = {
+	&gBusMenu,
+	&gSpiMenu,
+	&gLevel8Menu,
+#ifdef CMD_USE_MENU_POOLS
+	&gModulePool.node,
+#endif
+#ifdef CMD_USE_REPEAT
+	&Cmd_RepeatNode,
+	&Cmd_EveryNode,
+#endif
+#ifdef CMD_USE_TRACE
+	&Cmd_TraceNode,
+#endif
+};
+static const Cmd_Node_t gRootMenu = CMD_MENU("root", gRootItems);
+
+// Commands that are not supported by the configuration will simply fail.
+static const char * const gSession[] = {
+	"spi read 0x10 4\r",
+	"spi read $next 4\r",
+	"bus spi read 1k\r",
+	"bus spi ?\r",
+	"spi read ?\r",
+	"sp\tre\t12\r",
+	"spi write 0 [00 11 22 33 44 55 66 77 88 99 AA BB CC DD EE FF]\r",
+	"spi write 0 \"\\x00\\x11 escaped\"\r",
+	"spi name 'a somewhat longer name than usual'\r",
+	"spi enable true\r",
+	"spi status\r",
+	"spi dump 100\r",
+	"spi image 8k\r",
+	"spi mode ?\r",
+	"spi mode tu\t\r",
+	"spi sum 1 2 3 4 5 6 7 8 9 10 11 12\r",
+	"spi block 0x40 [1 0x20 9k6 65535 0 0 0 0 0 0 0 0 0 0 0 0]\r",
+	"spi missing 1\r",
+	"spi read 1 2 3\r",
+	"mod spi read 2\r",
+	"repeat 3 'spi read 1'\r",
+	"\x1b[A\r",
+	"trace show\r",
+	"l8 l7 l6 l5 l4 l3 l2 l1 spi read 1\r",
+	"l8 l7 l6 l5 l4 l3 l2 l1 spi re\t 2\r",
+	"l8 l7 l6 l5 l4 l3 l2 l1 spi ?\r",
+};
+
+static uint32_t gOutput;
+static uint8_t gHeap[HEAP_SIZE];
+static uint8_t gStack[STACK_SIZE];
+#ifdef CMD_USE_STREAM
+static uint8_t gImage[IMAGE_SIZE];
+static uint8_t gImageStream[IMAGE_SIZE * 9 / 8 + 32];
+static uint8_t gImageCheck[IMAGE_SIZE];
+#endif
+static ucontext_t gMainContext;
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+int main(void)
+{
+	// The session is run on a painted stack of its own, so that its high water mark can be found.
+	memset(gStack, STACK_PAINT, sizeof(gStack));
+	ucontext_t context;
+	getcontext(&context);
+	context.uc_stack.ss_sp = gStack;
+	context.uc_stack.ss_size = sizeof(gStack);
+	context.uc_link = &gMainContext;
+	makecontext(&context, Ref_Session, 0);
+	swapcontext(&gMainContext, &context);
+
+	printf("heap %u\n", Ref_HeapUsed(gHeap, sizeof(gHeap)));
+	printf("stack %u\n", Ref_StackUsed(gStack, sizeof(gStack)));
+	printf("output %u\n", gOutput);
+	return 0;
+}
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static void Ref_Session(void)
+{
+	memset(gHeap, HEAP_PAINT, sizeof(gHeap));
+
+	Cmd_Line_t line;
+	Cmd_Init(&line, &gRootMenu, Ref_Print, gHeap, sizeof(gHeap));
+#ifdef CMD_USE_ECHO
+	line.cfg.echo = true;
+#endif
+#ifdef CMD_USE_COLOR
+	line.cfg.color = true;
+#endif
+#ifdef CMD_PROMPT
+	line.cfg.prompt = true;
+#endif
+	Cmd_Start(&line);
+#ifdef CMD_USE_MENU_POOLS
+	Cmd_Attach(&gModulePool, &gBusMenu);
+	Cmd_Attach(&gModulePool, &gSpiMenu);
+	Cmd_Detach(&gModulePool, &gBusMenu);
+#endif
+#ifdef CMD_USE_SESSION_LOG
+	Cmd_SessionLog(&line, Ref_SessionWrite);
+#endif
+
+	for (uint32_t i = 0; i < LENGTH(gSession); i++)
+	{
+		Cmd_Parse(&line, (const uint8_t *)gSession[i], strlen(gSession[i]));
+	}
+}
+
+static void Ref_Print(const uint8_t * data, uint32_t size)
+{
+	(void)data;
+	gOutput += size;
+}
+
+#ifdef CMD_USE_SESSION_LOG
+static void Ref_SessionWrite(const uint8_t * data, uint32_t size)
+{
+	// The log is discarded, as only its cost is of interest.
+	(void)data;
+	(void)size;
+}
+#endif
+
+static void Ref_ReadFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args)
+{
+	uint32_t count = args[1].present ? args[1].number : 1;
+	Cmd_Printf(line, Cmd_Reply_Info, "read %u bytes from 0x%08X" CMD_LINE_END, count, args[0].number);
+#ifdef CMD_USE_REGISTERS
+	Cmd_SetRegister(line, "next", args[0].number + count);
+#endif
+}
+
+#ifdef CMD_USE_BYTE_ARGS
+static void Ref_WriteFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args)
+{
+	Cmd_Printf(line, Cmd_Reply_Info, "wrote %u bytes to 0x%08X" CMD_LINE_END, args[1].bytes.size, args[0].number);
+}
+#endif
+
+#ifdef CMD_USE_STRING_ARGS
+static void Ref_NameFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args)
+{
+	Cmd_Printf(line, Cmd_Reply_Info, "name is %s" CMD_LINE_END, args[0].str);
+}
+#endif
+
+#ifdef CMD_USE_BOOL_ARGS
+static void Ref_EnableFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args)
+{
+	Cmd_Prints(line, args[0].boolean ? Cmd_Reply_Info : Cmd_Reply_Warn, args[0].boolean ? "enabled" CMD_LINE_END : "disabled" CMD_LINE_END);
+}
+#endif
+
+#ifdef CMD_USE_LIST_ARGS
+static void Ref_BlockFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args)
+{
+	Cmd_Printf(line, Cmd_Reply_Info, "wrote %u registers to 0x%08X" CMD_LINE_END, args[1].list.count, args[0].number);
+}
+#endif
+
+#ifdef CMD_USE_RECORDS
+static void Ref_StatusFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args)
+{
+	(void)args;
+	static const uint8_t id[] = { 0xDE, 0xAD, 0xBE, 0xEF };
+	// Each format is used in turn, so that the deepest is measured.
+	for (uint8_t format = Cmd_Record_Text; format <= Cmd_Record_Cbor; format++)
+	{
+		line->cfg.record = format;
+		Cmd_BeginRecord(line, "status");
+		Cmd_RecordNumber(line, "clock", 48000000);
+		Cmd_RecordBytes(line, "id", id, sizeof(id));
+		Cmd_RecordString(line, "mode", "\"idle\"");
+		Cmd_EndRecord(line);
+	}
+	line->cfg.record = Cmd_Record_Text;
+}
+#endif
+
+#ifdef CMD_USE_DUMP
+static void Ref_DumpFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args)
+{
+	// Dumping the stack itself is as good as anything else.
+	uint32_t count = args[0].number < sizeof(gStack) ? args[0].number : sizeof(gStack);
+	for (uint8_t format = Cmd_Dump_Rows; format <= Cmd_Dump_Base64; format++)
+	{
+		Cmd_Dump(line, format, gStack, count, 0);
+	}
+}
+#endif
+
+#ifdef CMD_USE_STREAM
+static void Ref_ImageFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args)
+{
+	// Mostly zeros with sparse noise, like a trace buffer.
+	// Some runs of zeros are longer than the largest window, so that matches reach its end.
+	uint32_t count = args[0].number < IMAGE_SIZE ? args[0].number : IMAGE_SIZE;
+	uint32_t run = 0;
+	uint32_t next = IMAGE_GAP;
+	uint32_t seed = 1;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		gImage[i] = 0;
+		if (run++ == next)
+		{
+			seed = seed * 1103515245 + 12345;
+			gImage[i] = (uint8_t)(seed >> 16) | 1;
+			run = 0;
+			next = IMAGE_GAP + (seed >> 8) % IMAGE_SPAN;
+		}
+	}
+
+	// The stream is captured and expanded again, so that a broken stream fails the measurement.
+	// The stream state is on the stack, as it would be on the device.
+	Cmd_Capture_t capture = { gImageStream, sizeof(gImageStream), 0, NULL };
+	Cmd_Capture_t * previous = Cmd_Capture(line, &capture);
+	Cmd_Stream_t stream;
+	Cmd_BeginStream(line, &stream);
+	Cmd_WriteStream(line, &stream, gImage, count);
+	Cmd_EndStream(line, &stream);
+	Cmd_Capture(line, previous);
+
+	if (Ref_Expand(capture.data, capture.count, gImageCheck, sizeof(gImageCheck)) != count || memcmp(gImageCheck, gImage, count) != 0)
+	{
+		fprintf(stderr, "the stream did not expand to the image\n");
+		exit(1);
+	}
+	Cmd_Printf(line, Cmd_Reply_Info, "image %u bytes in %u" CMD_LINE_END, count, capture.count);
+}
+
+static uint32_t Ref_Expand(const uint8_t * src, uint32_t size, uint8_t * dst, uint32_t capacity)
+{
+	// This follows Tools/cmd_stream.py. UINT32_MAX is returned if the stream is malformed.
+	const uint8_t * end = src + size;
+	uint32_t count = 0;
+	if (size < 5 || memcmp(src, "CmdZ", 4) != 0)
+	{
+		return UINT32_MAX;
+	}
+	src += 5;
+	while (src < end)
+	{
+		uint8_t flags = *src++;
+		for (uint32_t bit = 0; bit < 8; bit++)
+		{
+			if (!(flags & (1 << bit)))
+			{
+				if (src >= end || count >= capacity)
+				{
+					return UINT32_MAX;
+				}
+				dst[count++] = *src++;
+				continue;
+			}
+			if (src + 2 > end)
+			{
+				return UINT32_MAX;
+			}
+			uint32_t distance = src[0] + 1;
+			uint32_t length = src[1];
+			src += 2;
+			if (length == 0xFF)
+			{
+				// The end marker is followed by the uncompressed size.
+				if (src + 4 != end)
+				{
+					return UINT32_MAX;
+				}
+				uint32_t total = src[0] | (src[1] << 8) | (src[2] << 16) | ((uint32_t)src[3] << 24);
+				return total == count ? count : UINT32_MAX;
+			}
+			length += 3;
+			if (distance > count || count + length > capacity)
+			{
+				return UINT32_MAX;
+			}
+			for (; length; length--, count++)
+			{
+				dst[count] = dst[count - distance];
+			}
+		}
+	}
+	return UINT32_MAX;
+}
+#endif
+
+#ifdef CMD_USE_CHOICE_ARGS
+static void Ref_ModeFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args)
+{
+	Cmd_Printf(line, Cmd_Reply_Info, "mode %u" CMD_LINE_END, args[0].number);
+}
+#endif
+
+#ifdef CMD_USE_VARIADIC_ARGS
+static void Ref_SumFunction(Cmd_Line_t * line, Cmd_ArgValue_t * args)
+{
+	uint32_t sum = 0;
+	for (uint32_t i = 0; i < args[0].variadic.count; i++)
+	{
+		sum += args[0].variadic.values[i].number;
+	}
+	Cmd_Printf(line, Cmd_Reply_Info, "sum %u" CMD_LINE_END, sum);
+}
+#endif
+
+static uint32_t Ref_HeapUsed(const uint8_t * heap, uint32_t size)
+{
+	// Memory may be taken from either end of the heap, so the largest untouched region is what was not needed.
+	uint32_t largest = 0;
+	uint32_t run = 0;
+	for (uint32_t i = 0; i < size; i++)
+	{
+		run = heap[i] == HEAP_PAINT ? run + 1 : 0;
+		if (run > largest)
+		{
+			largest = run;
+		}
+	}
+	return size - largest;
+}
+
+static uint32_t Ref_StackUsed(const uint8_t * stack, uint32_t size)
+{
+	// The stack grows down, so the untouched paint is at the bottom.
+	uint32_t untouched = 0;
+	while (untouched < size && stack[untouched] == STACK_PAINT)
+	{
+		untouched++;
+	}
+	return size - untouched;
+}